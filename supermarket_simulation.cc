@@ -9,6 +9,27 @@
 #include <fstream>
 #include <sstream>
 #include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdio>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <cstdlib>
+#include <type_traits>
 
 
 using namespace ns3;
@@ -17,520 +38,5859 @@ using namespace ns3;
 NS_LOG_COMPONENT_DEFINE("SupermarketSimulation");
 
 
-std::map<uint32_t, std::vector<double>> waitingTimes;
+// Build with -DSUPERMARKET_COUNT_ALLOCATIONS=1 for the benchmark's
+// allocations per customer. Every heap allocation in the process, ns-3
+// included, then goes through the operators below; otherwise the library's
+// own are used and the benchmark leaves that column empty.
+#ifndef SUPERMARKET_COUNT_ALLOCATIONS
+#define SUPERMARKET_COUNT_ALLOCATIONS 0
+#endif
+constexpr bool ALLOCATION_COUNTING = (SUPERMARKET_COUNT_ALLOCATIONS != 0);
+static std::atomic<uint64_t> g_allocations(0);
 
+// Events handled by every run in the process, for benchmarks that time runs
+// they do not see, such as the full sweep.
+static std::atomic<uint64_t> g_events(0);
 
-struct CashierResults
+
+#if SUPERMARKET_COUNT_ALLOCATIONS
+// Kept out of line so the compiler does not pair the malloc and free inside
+// them with new and delete at every call site. The array and nothrow forms
+// of the library forward to these.
+__attribute__((noinline)) void* operator new(std::size_t size)
 {
-    uint32_t numCashiers;
-    uint32_t totalCustomers;
-    double avgWaitingTime;
-    double utilization;
-    double efficiencyScore;
-};
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    void* memory = std::malloc(size ? size : 1);
+    if (memory == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
 
 
-std::vector<CashierResults> allResults;
+__attribute__((noinline)) void* operator new(std::size_t size, std::align_val_t alignment)
+{
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    void* memory = nullptr;
+    if (posix_memalign(&memory, std::max(static_cast<std::size_t>(alignment), sizeof(void*)), size ? size : 1) != 0)
+    {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
 
 
-class Customer : public Object
+__attribute__((noinline)) void operator delete(void* memory) noexcept
 {
-public:
-    Customer(uint32_t id, double arrivalTime);
-    virtual ~Customer();
-   
-    uint32_t GetId() const { return m_id; }
-    double GetArrivalTime() const { return m_arrivalTime; }
-    double GetServiceStartTime() const { return m_serviceStartTime; }
-    double GetServiceEndTime() const { return m_serviceEndTime; }
-    double GetWaitingTime() const { return m_serviceStartTime - m_arrivalTime; }
-    double GetServiceTime() const { return m_serviceEndTime - m_serviceStartTime; }
-   
-    void SetServiceStartTime(double time) { m_serviceStartTime = time; }
-    void SetServiceEndTime(double time) { m_serviceEndTime = time; }
-   
-    static TypeId GetTypeId(void);
-   
-private:
-    uint32_t m_id;
-    double m_arrivalTime;
-    double m_serviceStartTime;
-    double m_serviceEndTime;
-};
+    std::free(memory);
+}
 
 
-Customer::Customer(uint32_t id, double arrivalTime)
-    : m_id(id), m_arrivalTime(arrivalTime), m_serviceStartTime(0), m_serviceEndTime(0)
+__attribute__((noinline)) void operator delete(void* memory, std::size_t) noexcept
 {
+    std::free(memory);
 }
 
 
-Customer::~Customer()
+__attribute__((noinline)) void operator delete(void* memory, std::align_val_t) noexcept
 {
+    std::free(memory);
 }
 
 
-TypeId Customer::GetTypeId(void)
+__attribute__((noinline)) void operator delete(void* memory, std::size_t, std::align_val_t) noexcept
 {
-    static TypeId tid = TypeId("Customer")
-        .SetParent<Object>()
-        .SetGroupName("Supermarket");
-    return tid;
+    std::free(memory);
 }
+#endif
 
 
-class Cashier : public Object
+// Running mean and variance (Welford) plus extremes, so waiting-time
+// statistics need constant memory however many customers are served.
+class WaitingTimeStats
 {
 public:
-    Cashier(uint32_t id);
-    virtual ~Cashier();
-   
-    bool IsBusy() const { return m_busy; }
-    void StartService(Ptr<Customer> customer, double currentTime);
-    Ptr<Customer> EndService(double currentTime);
-    Ptr<Customer> GetCurrentCustomer() const { return m_currentCustomer; }
-    double GetTotalServiceTime() const { return m_totalServiceTime; }
-    double GetTotalIdleTime() const { return m_totalIdleTime; }
-    double GetLastIdleTime() const { return m_lastIdleTime; }
-    void FinalizeIdleTime(double currentTime);
+    WaitingTimeStats();
    
-    static TypeId GetTypeId(void);
+    void Add(double value);
+    uint64_t GetCount() const { return m_count; }
+    double GetMean() const { return m_mean; }
+    double GetVariance() const { return (m_count > 1) ? m_m2 / (m_count - 1) : 0; }
+    double GetStdDev() const { return std::sqrt(GetVariance()); }
+    double GetMin() const { return (m_count > 0) ? m_min : 0; }
+    double GetMax() const { return (m_count > 0) ? m_max : 0; }
    
 private:
-    uint32_t m_id;
-    bool m_busy;
-    Ptr<Customer> m_currentCustomer;
-    double m_totalServiceTime;
-    double m_totalIdleTime;
-    double m_lastIdleTime;
-    double m_lastActivityTime;
+    uint64_t m_count;
+    double m_mean;
+    double m_m2;
+    double m_min;
+    double m_max;
 };
 
 
-Cashier::Cashier(uint32_t id)
-    : m_id(id), m_busy(false), m_currentCustomer(nullptr), m_totalServiceTime(0),
-      m_totalIdleTime(0), m_lastIdleTime(0), m_lastActivityTime(0)
+WaitingTimeStats::WaitingTimeStats()
+    : m_count(0), m_mean(0), m_m2(0),
+      m_min(std::numeric_limits<double>::max()), m_max(std::numeric_limits<double>::lowest())
 {
 }
 
 
-Cashier::~Cashier()
+void WaitingTimeStats::Add(double value)
 {
+    m_count++;
+    double delta = value - m_mean;
+    m_mean += delta / m_count;
+    m_m2 += delta * (value - m_mean);
+    m_min = std::min(m_min, value);
+    m_max = std::max(m_max, value);
 }
 
 
-void Cashier::StartService(Ptr<Customer> customer, double currentTime)
+// Half-width of the two-sided 95% Student-t interval for the mean of
+// independent observations, e.g. replication or batch means.
+double ConfidenceHalfWidth95(const WaitingTimeStats& observations)
 {
-    if (m_busy)
-    {
-        NS_LOG_ERROR("Cashier " << m_id << " is already busy!");
-        return;
-    }
+    static const double tQuantiles[] = {
+        12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
    
-    if (!m_busy && m_lastActivityTime > 0)
+    uint64_t n = observations.GetCount();
+    if (n < 2)
     {
-        m_totalIdleTime += (currentTime - m_lastActivityTime);
-        m_lastIdleTime = (currentTime - m_lastActivityTime);
-    }
-    else if (m_lastActivityTime == 0)
-    {
-        m_totalIdleTime += currentTime;
-        m_lastIdleTime = currentTime;
+        return std::numeric_limits<double>::infinity();
     }
    
-    m_busy = true;
-    m_currentCustomer = customer;
-    customer->SetServiceStartTime(currentTime);
-    m_lastActivityTime = currentTime;
-}
-
-
-Ptr<Customer> Cashier::EndService(double currentTime)
-{
-    if (!m_busy)
+    uint64_t degreesOfFreedom = n - 1;
+    double t;
+    if (degreesOfFreedom <= 30)
     {
-        NS_LOG_ERROR("Cashier " << m_id << " is not busy!");
-        return nullptr;
+        t = tQuantiles[degreesOfFreedom - 1];
     }
-   
-    if (m_currentCustomer == nullptr)
+    else if (degreesOfFreedom <= 60)
     {
-        NS_LOG_ERROR("Cashier " << m_id << " has null customer pointer!");
-        m_busy = false;
-        return nullptr;
+        t = 2.021;
     }
-   
-    double serviceTime = currentTime - m_currentCustomer->GetServiceStartTime();
-    m_totalServiceTime += serviceTime;
-    m_currentCustomer->SetServiceEndTime(currentTime);
-    Ptr<Customer> completedCustomer = m_currentCustomer;
-    m_busy = false;
-    m_currentCustomer = nullptr;
-    m_lastActivityTime = currentTime;
-    return completedCustomer;
-}
-
-
-void Cashier::FinalizeIdleTime(double currentTime)
-{
-    if (!m_busy && m_lastActivityTime > 0)
+    else if (degreesOfFreedom <= 120)
     {
-        m_totalIdleTime += (currentTime - m_lastActivityTime);
+        t = 2.000;
     }
-    else if (m_lastActivityTime == 0)
+    else
     {
-        m_totalIdleTime = currentTime;
+        t = 1.960;
     }
+    return t * observations.GetStdDev() / std::sqrt(static_cast<double>(n));
 }
 
 
-TypeId Cashier::GetTypeId(void)
-{
-    static TypeId tid = TypeId("Cashier")
-        .SetParent<Object>()
-        .SetGroupName("Supermarket");
-    return tid;
-}
-
-
-class SupermarketSimulation
+// Streaming estimate of three quantiles with the extended P-square
+// algorithm (Jain and Chlamtac; Raatikainen): nine markers, at the minimum,
+// each quantile, the midpoints between them and the maximum, whose heights
+// are nudged by piecewise-parabolic interpolation as samples arrive, so O(1)
+// time and space per sample. The quantiles share one ordered set of
+// markers, so their estimates cannot cross.
+class P2Quantiles
 {
 public:
-    SupermarketSimulation(uint32_t numCashiers, double arrivalRate, double serviceRate);
-    void RunSimulation(double simulationTime);
-    void PrintResults();
-   
-private:
-    void CustomerArrival();
-    void CustomerServiceEnd(uint32_t cashierId);
-    void ScheduleNextArrival();
-    void ScheduleServiceEnd(uint32_t cashierId, double serviceTime);
-    void StopSimulation();
-   
-    uint32_t m_numCashiers;
-    double m_arrivalRate;
-    double m_serviceRate;
-    double m_simulationTime;
-    uint32_t m_customerId;
+    static constexpr int MARKERS = 9;
    
-    std::vector<Ptr<Cashier>> m_cashiers;
-    std::queue<Ptr<Customer>> m_queue;
-    std::vector<Ptr<Customer>> m_completedCustomers;
+    P2Quantiles(double p1, double p2, double p3);
+    void Add(double x);
+    double Get(int quantile) const;
    
-    Ptr<ExponentialRandomVariable> m_arrivalRandom;
-    Ptr<ExponentialRandomVariable> m_serviceRandom;
+private:
+    double Parabolic(int i, double d) const;
    
-    EventId m_nextArrivalEvent;
-    std::vector<EventId> m_serviceEndEvents;
-    bool m_stopped;
+    double m_p[3];
+    uint64_t m_count;
+    double m_height[MARKERS];
+    double m_position[MARKERS];
+    double m_desired[MARKERS];
+    double m_increment[MARKERS];
 };
 
 
-SupermarketSimulation::SupermarketSimulation(uint32_t numCashiers, double arrivalRate, double serviceRate)
-    : m_numCashiers(numCashiers), m_arrivalRate(arrivalRate), m_serviceRate(serviceRate),
-      m_simulationTime(0), m_customerId(0), m_stopped(false)
+P2Quantiles::P2Quantiles(double p1, double p2, double p3)
+    : m_p{p1, p2, p3}, m_count(0)
 {
-    for (uint32_t i = 0; i < m_numCashiers; i++)
+    double fractions[MARKERS] = {0, p1 / 2, p1, (p1 + p2) / 2, p2, (p2 + p3) / 2, p3, (1 + p3) / 2, 1};
+    for (int i = 0; i < MARKERS; i++)
     {
-        Ptr<Cashier> cashier = CreateObject<Cashier>(i);
-        m_cashiers.push_back(cashier);
+        m_height[i] = 0;
+        m_position[i] = i + 1;
+        m_desired[i] = 1 + (MARKERS - 1) * fractions[i];
+        m_increment[i] = fractions[i];
     }
-   
-    m_arrivalRandom = CreateObject<ExponentialRandomVariable>();
-    m_arrivalRandom->SetAttribute("Mean", DoubleValue(1.0 / m_arrivalRate));
-   
-    m_serviceRandom = CreateObject<ExponentialRandomVariable>();
-    m_serviceRandom->SetAttribute("Mean", DoubleValue(1.0 / m_serviceRate));
-   
-    m_serviceEndEvents.resize(m_numCashiers);
 }
 
 
-void SupermarketSimulation::RunSimulation(double simulationTime)
+void P2Quantiles::Add(double x)
 {
-    NS_LOG_INFO("Starting simulation with " << m_numCashiers << " cashiers");
-    NS_LOG_INFO("Arrival rate: " << m_arrivalRate << " customers/second");
-    NS_LOG_INFO("Service rate: " << m_serviceRate << " customers/second");
-    NS_LOG_INFO("Simulation time: " << simulationTime << " seconds");
-   
-    m_simulationTime = simulationTime;
-    m_stopped = false;
-   
-    ScheduleNextArrival();
-   
-    Simulator::Schedule(Seconds(simulationTime), &SupermarketSimulation::StopSimulation, this);
-   
-    Simulator::Run();
-   
-    double currentTime = Simulator::Now().GetSeconds();
-    for (uint32_t i = 0; i < m_numCashiers; i++)
+    if (m_count < MARKERS)
     {
-        if (m_cashiers[i]->IsBusy())
-        {
-            Ptr<Customer> customer = m_cashiers[i]->EndService(currentTime);
-            if (customer != nullptr)
-            {
-                m_completedCustomers.push_back(customer);
-                waitingTimes[m_numCashiers].push_back(customer->GetWaitingTime());
-            }
-        }
-        else
+        m_height[m_count++] = x;
+        if (m_count == MARKERS)
         {
-            m_cashiers[i]->FinalizeIdleTime(currentTime);
+            std::sort(m_height, m_height + MARKERS);
         }
+        return;
     }
-}
-
-
-void SupermarketSimulation::StopSimulation()
-{
-    m_stopped = true;
-    if (!m_nextArrivalEvent.IsExpired())
-    {
-        Simulator::Cancel(m_nextArrivalEvent);
-    }
-    for (uint32_t i = 0; i < m_numCashiers; i++)
+    m_count++;
+   
+    int k;
+    if (x < m_height[0])
     {
-        if (!m_serviceEndEvents[i].IsExpired())
-        {
-            Simulator::Cancel(m_serviceEndEvents[i]);
-        }
+        m_height[0] = x;
+        k = 0;
     }
-    Simulator::Stop();
-}
-
-
-void SupermarketSimulation::CustomerArrival()
-{
-    if (m_stopped)
+    else if (x >= m_height[MARKERS - 1])
     {
-        return;
+        m_height[MARKERS - 1] = x;
+        k = MARKERS - 2;
     }
-   
-    double currentTime = Simulator::Now().GetSeconds();
-   
-    Ptr<Customer> customer = CreateObject<Customer>(m_customerId++, currentTime);
-   
-    bool assigned = false;
-    for (uint32_t i = 0; i < m_numCashiers; i++)
+    else
     {
-        if (!m_cashiers[i]->IsBusy())
+        k = 0;
+        while (x >= m_height[k + 1])
         {
-            m_cashiers[i]->StartService(customer, currentTime);
-            double serviceTime = m_serviceRandom->GetValue();
-            ScheduleServiceEnd(i, serviceTime);
-            assigned = true;
-            break;
+            k++;
         }
     }
    
-    if (!assigned)
+    for (int i = k + 1; i < MARKERS; i++)
     {
-        m_queue.push(customer);
+        m_position[i]++;
+    }
+    for (int i = 0; i < MARKERS; i++)
+    {
+        m_desired[i] += m_increment[i];
     }
    
-    if (!m_stopped)
+    // A marker only moves to a height between its neighbours, so the
+    // heights stay sorted.
+    for (int i = 1; i < MARKERS - 1; i++)
     {
-        ScheduleNextArrival();
+        double d = m_desired[i] - m_position[i];
+        if ((d >= 1 && m_position[i + 1] - m_position[i] > 1) || (d <= -1 && m_position[i - 1] - m_position[i] < -1))
+        {
+            double step = (d > 0) ? 1 : -1;
+            double height = Parabolic(i, step);
+            if (!(m_height[i - 1] < height && height < m_height[i + 1]))
+            {
+                int j = i + static_cast<int>(step);
+                height = m_height[i] + step * (m_height[j] - m_height[i]) / (m_position[j] - m_position[i]);
+            }
+            m_height[i] = std::min(std::max(height, m_height[i - 1]), m_height[i + 1]);
+            m_position[i] += step;
+        }
     }
 }
 
 
-void SupermarketSimulation::CustomerServiceEnd(uint32_t cashierId)
+double P2Quantiles::Parabolic(int i, double d) const
 {
-    if (m_stopped)
-    {
-        return;
-    }
-   
-    double currentTime = Simulator::Now().GetSeconds();
-    Ptr<Cashier> cashier = m_cashiers[cashierId];
+    return m_height[i] + d / (m_position[i + 1] - m_position[i - 1]) *
+        ((m_position[i] - m_position[i - 1] + d) * (m_height[i + 1] - m_height[i]) / (m_position[i + 1] - m_position[i]) +
+         (m_position[i + 1] - m_position[i] - d) * (m_height[i] - m_height[i - 1]) / (m_position[i] - m_position[i - 1]));
+}
 
-    Ptr<Customer> customer = cashier->EndService(currentTime);
-   
-    if (customer == nullptr)
+
+// quantile indexes the p given to the constructor. Until nine samples have
+// arrived the exact sample quantile is returned.
+double P2Quantiles::Get(int quantile) const
+{
+    double p = m_p[quantile];
+    if (m_count == 0)
     {
-        NS_LOG_ERROR("CustomerServiceEnd: Got null customer from cashier " << cashierId);
-        return;
+        return 0;
     }
-   
-    m_completedCustomers.push_back(customer);
-   
-    waitingTimes[m_numCashiers].push_back(customer->GetWaitingTime());
-   
-    if (!m_queue.empty())
+    if (m_count < MARKERS)
     {
-        Ptr<Customer> nextCustomer = m_queue.front();
-        m_queue.pop();
-        cashier->StartService(nextCustomer, currentTime);
-        double serviceTime = m_serviceRandom->GetValue();
-        ScheduleServiceEnd(cashierId, serviceTime);
+        double sorted[MARKERS];
+        std::copy(m_height, m_height + m_count, sorted);
+        std::sort(sorted, sorted + m_count);
+        return sorted[std::min<uint64_t>(static_cast<uint64_t>(p * m_count), m_count - 1)];
     }
+    return m_height[2 * quantile + 2];
 }
 
 
-void SupermarketSimulation::ScheduleNextArrival()
+// Integral of a piecewise-constant quantity, such as the queue length, over
+// simulated time, updated in O(1) whenever the quantity changes.
+class TimeWeightedStat
 {
-    if (m_stopped)
+public:
+    TimeWeightedStat() : m_value(0), m_max(0), m_area(0), m_start(0), m_last(0) {}
+    void Set(double currentTime, double value)
     {
-        return;
+        m_area += m_value * (currentTime - m_last);
+        m_last = currentTime;
+        m_value = value;
+        m_max = std::max(m_max, value);
     }
-   
-    double currentTime = Simulator::Now().GetSeconds();
-    double interArrivalTime = m_arrivalRandom->GetValue();
-    double nextArrivalTime = currentTime + interArrivalTime;
-   
-    if (nextArrivalTime < m_simulationTime)
+    void Add(double currentTime, double delta) { Set(currentTime, m_value + delta); }
+    void Reset(double currentTime)
     {
-        m_nextArrivalEvent = Simulator::Schedule(Seconds(interArrivalTime),
-            &SupermarketSimulation::CustomerArrival, this);
+        m_max = m_value;
+        m_area = 0;
+        m_start = currentTime;
+        m_last = currentTime;
     }
-}
+    double GetValue() const { return m_value; }
+    double GetMax() const { return m_max; }
+    double GetStart() const { return m_start; }
+    double GetArea(double currentTime) const { return m_area + m_value * (currentTime - m_last); }
+    double GetMean(double currentTime) const;
+   
+private:
+    double m_value;
+    double m_max;
+    double m_area;
+    double m_start;
+    double m_last;
+};
 
 
-void SupermarketSimulation::ScheduleServiceEnd(uint32_t cashierId, double serviceTime)
+double TimeWeightedStat::GetMean(double currentTime) const
 {
-    m_serviceEndEvents[cashierId] = Simulator::Schedule(Seconds(serviceTime),
-        &SupermarketSimulation::CustomerServiceEnd, this, cashierId);
+    double span = currentTime - m_start;
+    return (span > 0) ? GetArea(currentTime) / span : 0;
 }
 
 
-void SupermarketSimulation::PrintResults()
+// Byte buffer for checkpoints. Values are stored in their in-memory layout,
+// so a snapshot is meant to be read back by the same build on the same host.
+// A failed read marks the snapshot invalid and later reads return zeroes, so
+// loaders can read straight through and check IsValid() once at the end.
+class Snapshot
 {
-    double totalWaitingTime = 0;
-    double totalServiceTime = 0;
-    double totalIdleTime = 0;
+public:
+    Snapshot() : m_read(0), m_valid(true) {}
    
-    for (auto& wt : waitingTimes[m_numCashiers])
+    template <typename T>
+    void Put(const T& value)
     {
-        totalWaitingTime += wt;
+        static_assert(std::is_trivially_copyable<T>::value, "snapshot values must be trivially copyable");
+        m_bytes.append(reinterpret_cast<const char*>(&value), sizeof(T));
     }
-   
-    for (auto& cashier : m_cashiers)
+    template <typename T>
+    void PutVector(const std::vector<T>& values)
     {
-        totalServiceTime += cashier->GetTotalServiceTime();
-        totalIdleTime += cashier->GetTotalIdleTime();
+        static_assert(std::is_trivially_copyable<T>::value, "snapshot values must be trivially copyable");
+        Put<uint64_t>(values.size());
+        m_bytes.append(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
     }
-   
-    double avgWaitingTime = (waitingTimes[m_numCashiers].size() > 0) ?
-        totalWaitingTime / waitingTimes[m_numCashiers].size() : 0;
-    double utilization = (totalServiceTime + totalIdleTime > 0) ?
-        totalServiceTime / (totalServiceTime + totalIdleTime) : 0;
-   
-    double efficiencyScore = utilization / (avgWaitingTime + 1.0);
-   
-    CashierResults results;
-    results.numCashiers = m_numCashiers;
-    results.totalCustomers = m_completedCustomers.size();
-    results.avgWaitingTime = avgWaitingTime;
-    results.utilization = utilization;
-    results.efficiencyScore = efficiencyScore;
-    allResults.push_back(results);
-   
-    std::cout << "\nResults for " << m_numCashiers << " cashiers" << std::endl;
-    std::cout << "Total customers served: " << m_completedCustomers.size() << std::endl;
-    std::cout << "Average waiting time: " << std::fixed << std::setprecision(2) << avgWaitingTime << " seconds" << std::endl;
-    std::cout << "System utilization: " << std::fixed << std::setprecision(1) << utilization * 100 << "%" << std::endl;
-    std::cout << "Efficiency score: " << std::fixed << std::setprecision(3) << efficiencyScore << std::endl;
-}
-
-
-uint32_t FindOptimalCashiers(double minUtilization = 0.60, double maxUtilization = 0.90)
-{
-    if (allResults.empty())
+    void PutString(const std::string& value)
     {
-        return 0;
+        Put<uint64_t>(value.size());
+        m_bytes.append(value);
     }
    
-    std::vector<CashierResults> goodResults;
-    for (auto& result : allResults)
+    template <typename T>
+    void Get(T& value)
     {
-        if (result.utilization >= minUtilization && result.utilization <= maxUtilization)
+        if (!Take(&value, sizeof(T)))
         {
-            goodResults.push_back(result);
+            std::memset(static_cast<void*>(&value), 0, sizeof(T));
         }
     }
-   
-    if (goodResults.empty())
+    template <typename T>
+    void GetVector(std::vector<T>& values)
     {
-        uint32_t bestCashiers = allResults[0].numCashiers;
-        double bestScore = allResults[0].efficiencyScore;
-       
-        for (auto& result : allResults)
+        uint64_t size = 0;
+        Get(size);
+        if (size > (m_bytes.size() - m_read) / std::max<size_t>(sizeof(T), 1))
         {
-            if (result.efficiencyScore > bestScore)
-            {
-                bestScore = result.efficiencyScore;
-                bestCashiers = result.numCashiers;
-            }
+            m_valid = false;
+            size = 0;
         }
-        return bestCashiers;
+        values.resize(size);
+        Take(values.data(), size * sizeof(T));
+    }
+    void GetString(std::string& value)
+    {
+        std::vector<char> chars;
+        GetVector(chars);
+        value.assign(chars.begin(), chars.end());
     }
    
-    uint32_t bestCashiers = goodResults[0].numCashiers;
-    double bestWaitingTime = goodResults[0].avgWaitingTime;
+    bool IsValid() const { return m_valid; }
+    size_t GetSize() const { return m_bytes.size(); }
+    bool WriteFile(const std::string& filename) const;
+    bool ReadFile(const std::string& filename);
    
-    for (auto& result : goodResults)
+private:
+    bool Take(void* data, size_t size)
     {
-        if (result.avgWaitingTime < bestWaitingTime)
+        if (!m_valid || size > m_bytes.size() - m_read)
         {
-            bestWaitingTime = result.avgWaitingTime;
-            bestCashiers = result.numCashiers;
+            m_valid = false;
+            return false;
         }
+        std::memcpy(data, m_bytes.data() + m_read, size);
+        m_read += size;
+        return true;
     }
    
-    return bestCashiers;
+    std::string m_bytes;
+    size_t m_read;
+    bool m_valid;
+};
+
+
+// Written beside the target and renamed over it, so a crash mid-write leaves
+// the previous checkpoint intact.
+bool Snapshot::WriteFile(const std::string& filename) const
+{
+    std::string temporary = filename + ".tmp";
+    FILE* out = std::fopen(temporary.c_str(), "wb");
+    if (out == nullptr)
+    {
+        NS_LOG_ERROR("Could not open " << temporary << " for writing");
+        return false;
+    }
+    bool ok = std::fwrite("SMCKP001", 1, 8, out) == 8 &&
+              std::fwrite(m_bytes.data(), 1, m_bytes.size(), out) == m_bytes.size();
+    ok = (std::fclose(out) == 0) && ok;
+    if (!ok || std::rename(temporary.c_str(), filename.c_str()) != 0)
+    {
+        NS_LOG_ERROR("Could not write checkpoint " << filename);
+        std::remove(temporary.c_str());
+        return false;
+    }
+    return true;
 }
 
 
-void GenerateUtilizationPlot(const std::string& filename = "utilization.plt")
+bool Snapshot::ReadFile(const std::string& filename)
 {
-    if (allResults.empty())
+    std::ifstream in(filename, std::ios::binary);
+    if (!in.is_open())
     {
-        std::cerr << "No results available for plotting utilization." << std::endl;
-        return;
+        return false;
     }
-   
-    std::vector<CashierResults> sortedResults = allResults;
-    std::sort(sortedResults.begin(), sortedResults.end(),
-        [](const CashierResults& a, const CashierResults& b) {
-            return a.numCashiers < b.numCashiers;
-        });
-   
-    std::string dataFile = "utilization_data.dat";
-    std::ofstream dataOut(dataFile);
-    if (!dataOut.is_open())
+    std::ostringstream contents;
+    contents << in.rdbuf();
+    m_bytes = contents.str();
+    m_read = 0;
+    m_valid = (m_bytes.size() >= 8 && m_bytes.compare(0, 8, "SMCKP001") == 0);
+    m_read = m_valid ? 8 : 0;
+    return m_valid;
+}
+
+
+// MSER-5 truncation point: the number of leading samples to delete so the
+// remaining batch means of five have the smallest squared standard error.
+// Only the first half of the run is considered, as the heuristic recommends.
+size_t Mser5TruncationPoint(const std::vector<double>& samples)
+{
+    const size_t batchSize = 5;
+    size_t numBatches = samples.size() / batchSize;
+    if (numBatches < 2)
     {
-        std::cerr << "Error: Could not open data file " << dataFile << " for writing." << std::endl;
-        return;
+        return 0;
     }
    
-    dataOut << "# Cashiers Utilization(%)\n";
-    for (const auto& result : sortedResults)
+    std::vector<double> means(numBatches);
+    for (size_t j = 0; j < numBatches; j++)
     {
-        dataOut << result.numCashiers << " "
-                << std::fixed << std::setprecision(2)
-                << result.utilization * 100.0 << "\n";
+        double sum = 0;
+        for (size_t i = 0; i < batchSize; i++)
+        {
+            sum += samples[j * batchSize + i];
+        }
+        means[j] = sum / batchSize;
     }
-    dataOut.close();
    
-    std::ofstream pltOut(filename);
-    if (!pltOut.is_open())
+    double suffixSum = 0;
+    double suffixSquares = 0;
+    std::vector<double> mser(numBatches, std::numeric_limits<double>::max());
+    for (size_t d = numBatches; d > 0; d--)
     {
-        std::cerr << "Error: Could not open PLT file " << filename << " for writing." << std::endl;
-        return;
+        suffixSum += means[d - 1];
+        suffixSquares += means[d - 1] * means[d - 1];
+        double kept = static_cast<double>(numBatches - d + 1);
+        double sumOfSquares = suffixSquares - suffixSum * suffixSum / kept;
+        mser[d - 1] = sumOfSquares / (kept * kept);
     }
    
-    pltOut << "# GNUplot script for Cashier Utilization\n";
-    pltOut << "# Generated by Supermarket Simulation\n\n";
-    pltOut << "set terminal pngcairo enhanced color font 'Arial,12' size 800,600\n";
-    pltOut << "set output 'utilization.png'\n\n";
-    pltOut << "# To customize title font size, use: set title 'Title' font 'Arial,16'\n";
-    pltOut << "set title 'Cashier Utilization vs Number of Cashiers'\n";
-    pltOut << "set xlabel 'Number of Cashiers'\n";
-    pltOut << "set ylabel 'Utilization (%)'\n";
-    pltOut << "set grid linestyle 1 linecolor rgb '#cccccc'\n";
-    pltOut << "set key top right\n";
+    size_t best = 0;
+    for (size_t d = 1; d <= numBatches / 2; d++)
+    {
+        if (mser[d] < mser[best])
+        {
+            best = d;
+        }
+    }
+    return best * batchSize;
+}
+
+
+// Build with -DSUPERMARKET_INSTRUMENTATION=1 to collect RunCounters. When
+// off, every counter update sits behind a constant-false branch and is
+// compiled out.
+#ifndef SUPERMARKET_INSTRUMENTATION
+#define SUPERMARKET_INSTRUMENTATION 0
+#endif
+constexpr bool INSTRUMENTATION_ENABLED = (SUPERMARKET_INSTRUMENTATION != 0);
+
+
+// Wall-clock reading for RunCounters; a constant when instrumentation is
+// off, so the default build makes no clock calls on the run path.
+inline std::chrono::steady_clock::time_point InstrumentationNow()
+{
+    return INSTRUMENTATION_ENABLED ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+}
+
+
+struct RunCounters
+{
+    uint64_t arrivalEvents;
+    uint64_t serviceEndEvents;
+    uint64_t controlEvents;
+    uint64_t schedules;
+    uint64_t cancels;
+    uint64_t variateDraws;
+    uint64_t maxQueueLength;
+    double queueLengthAtArrivals;
+    double queueArea;
+    double queueSpan;
+    double simulatedTime;
+    double runSeconds;
+    double drainSeconds;
+    double reportSeconds;
+   
+    void Add(const RunCounters& other);
+};
+
+
+void RunCounters::Add(const RunCounters& other)
+{
+    arrivalEvents += other.arrivalEvents;
+    serviceEndEvents += other.serviceEndEvents;
+    controlEvents += other.controlEvents;
+    schedules += other.schedules;
+    cancels += other.cancels;
+    variateDraws += other.variateDraws;
+    maxQueueLength = std::max(maxQueueLength, other.maxQueueLength);
+    queueLengthAtArrivals += other.queueLengthAtArrivals;
+    queueArea += other.queueArea;
+    queueSpan += other.queueSpan;
+    simulatedTime += other.simulatedTime;
+    runSeconds += other.runSeconds;
+    drainSeconds += other.drainSeconds;
+    reportSeconds += other.reportSeconds;
+}
+
+
+void PrintRunCounters(const RunCounters& counters, std::ostream& os)
+{
+    os << "Events: " << counters.arrivalEvents << " arrivals, " << counters.serviceEndEvents << " service ends, "
+       << counters.controlEvents << " control; " << counters.schedules << " schedules, " << counters.cancels
+       << " cancels, " << counters.variateDraws << " variate draws" << std::endl;
+    os << "Queue length: max " << counters.maxQueueLength << ", time-average " << std::fixed << std::setprecision(3)
+       << ((counters.queueSpan > 0) ? counters.queueArea / counters.queueSpan : 0) << ", seen by arrivals "
+       << ((counters.arrivalEvents > 0) ? counters.queueLengthAtArrivals / counters.arrivalEvents : 0) << std::endl;
+    os << "Wall time: run " << std::setprecision(3) << counters.runSeconds * 1e3 << " ms, drain "
+       << counters.drainSeconds * 1e3 << " ms, report " << counters.reportSeconds * 1e3 << " ms; "
+       << std::setprecision(0) << ((counters.runSeconds > 0) ? counters.simulatedTime / counters.runSeconds : 0)
+       << " simulated s per wall s" << std::endl;
+}
+
+
+struct CashierResults
+{
+    uint32_t numCashiers;
+    uint32_t totalCustomers;
+    double avgWaitingTime;
+    double waitingTimeCiHalfWidth;
+    uint32_t ciSamples;
+    double waitingTimeStdDev;
+    double minWaitingTime;
+    double maxWaitingTime;
+    double utilization;
+    double efficiencyScore;
+    double warmupTime;
+    double waitingTimeP50;
+    double waitingTimeP95;
+    double waitingTimeP99;
+    double avgQueueLength;
+    double avgBusyCashiers;
+    RunCounters counters;
+};
+
+
+class ReportWriter;
+
+
+std::vector<CashierResults> allResults;
+
+// Set while a ReportWriter runs alongside a sweep that forks no workers, or
+// alongside RunStore; RecordResults hands it every result added to
+// allResults.
+ReportWriter* g_reportWriter = nullptr;
+
+
+void RecordResults(const CashierResults& results);
+
+
+const double DEFAULT_MIN_UTILIZATION = 0.60;
+const double DEFAULT_MAX_UTILIZATION = 0.90;
+
+
+void PrintCashierResults(const CashierResults& results, std::ostream& os)
+{
+    os << "\nResults for " << results.numCashiers << " cashiers" << std::endl;
+    if (results.warmupTime > 0)
+    {
+        os << "Warm-up deleted: first " << std::fixed << std::setprecision(2) << results.warmupTime << " seconds" << std::endl;
+    }
+    os << "Total customers served: " << results.totalCustomers << std::endl;
+    os << "Average waiting time: " << std::fixed << std::setprecision(2) << results.avgWaitingTime << " seconds" << std::endl;
+    if (results.ciSamples > 1)
+    {
+        os << "95% CI half-width: " << std::fixed << std::setprecision(3) << results.waitingTimeCiHalfWidth
+           << " seconds (" << results.ciSamples << " samples)" << std::endl;
+    }
+    os << "Waiting time std dev: " << std::fixed << std::setprecision(2) << results.waitingTimeStdDev
+       << " seconds (max " << results.maxWaitingTime << ")" << std::endl;
+    os << "Waiting time percentiles: p50 " << results.waitingTimeP50 << ", p95 " << results.waitingTimeP95
+       << ", p99 " << results.waitingTimeP99 << " seconds" << std::endl;
+    os << "Average queue length: " << std::fixed << std::setprecision(3) << results.avgQueueLength
+       << " (busy cashiers " << results.avgBusyCashiers << ")" << std::endl;
+    os << "System utilization: " << std::fixed << std::setprecision(1) << results.utilization * 100 << "%" << std::endl;
+    os << "Efficiency score: " << std::fixed << std::setprecision(3) << results.efficiencyScore << std::endl;
+}
+
+
+struct Customer
+{
+    uint32_t id;
+    bool priority;
+    bool waiting;
+    bool reneged;
+    double arrivalTime;
+    double serviceDemand;
+    double serviceStartTime;
+    double serviceEndTime;
+   
+    double GetWaitingTime() const { return serviceStartTime - arrivalTime; }
+    double GetServiceTime() const { return serviceEndTime - serviceStartTime; }
+};
+
+
+const uint32_t NO_CUSTOMER = std::numeric_limits<uint32_t>::max();
+
+
+// Vectors left behind by finished runs. A simulation is built afresh for
+// every configuration, replication and grid point, so the customer arena,
+// variate blocks and event calendar of the next run in the process start
+// from the capacity of the last one instead of regrowing it.
+template <typename T>
+class SpareStorage
+{
+public:
+    static std::vector<T> Take()
+    {
+        std::vector<std::vector<T>>& spares = GetSpares();
+        if (spares.empty())
+        {
+            return std::vector<T>();
+        }
+        std::vector<T> storage = std::move(spares.back());
+        spares.pop_back();
+        storage.clear();
+        return storage;
+    }
+   
+    static void Return(std::vector<T>& storage)
+    {
+        std::vector<std::vector<T>>& spares = GetSpares();
+        if (storage.capacity() > 0 && spares.size() < MAX_SPARES)
+        {
+            spares.push_back(std::move(storage));
+        }
+    }
+   
+private:
+    static constexpr size_t MAX_SPARES = 8;
+   
+    static std::vector<std::vector<T>>& GetSpares()
+    {
+        static std::vector<std::vector<T>> spares;
+        return spares;
+    }
+};
+
+
+// Customer records live in one arena and are handed around by index. Released
+// slots go on a free list, so once the arena has grown to the peak number of
+// customers in the system, arrivals no longer allocate.
+class CustomerPool
+{
+public:
+    CustomerPool() : m_customers(SpareStorage<Customer>::Take()), m_freeList(SpareStorage<uint32_t>::Take()) {}
+    ~CustomerPool()
+    {
+        SpareStorage<Customer>::Return(m_customers);
+        SpareStorage<uint32_t>::Return(m_freeList);
+    }
+   
+    uint32_t Allocate(uint32_t id, double arrivalTime);
+    void Release(uint32_t index);
+    Customer& operator[](uint32_t index) { return m_customers[index]; }
+    const Customer& operator[](uint32_t index) const { return m_customers[index]; }
+    uint32_t GetCapacity() const { return m_customers.size(); }
+    void Save(Snapshot& snapshot) const
+    {
+        snapshot.PutVector(m_customers);
+        snapshot.PutVector(m_freeList);
+    }
+    void Load(Snapshot& snapshot)
+    {
+        snapshot.GetVector(m_customers);
+        snapshot.GetVector(m_freeList);
+    }
+   
+private:
+    std::vector<Customer> m_customers;
+    std::vector<uint32_t> m_freeList;
+};
+
+
+uint32_t CustomerPool::Allocate(uint32_t id, double arrivalTime)
+{
+    uint32_t index;
+    if (!m_freeList.empty())
+    {
+        index = m_freeList.back();
+        m_freeList.pop_back();
+    }
+    else
+    {
+        index = m_customers.size();
+        m_customers.emplace_back();
+        m_freeList.reserve(m_customers.capacity());
+    }
+   
+    Customer& customer = m_customers[index];
+    customer.id = id;
+    customer.priority = false;
+    customer.waiting = false;
+    customer.reneged = false;
+    customer.arrivalTime = arrivalTime;
+    customer.serviceDemand = 0;
+    customer.serviceStartTime = 0;
+    customer.serviceEndTime = 0;
+    return index;
+}
+
+
+void CustomerPool::Release(uint32_t index)
+{
+    m_freeList.push_back(index);
+}
+
+
+// FIFO of customer indices in a power-of-two ring that only grows, unlike
+// std::deque which allocates and frees blocks as the queue breathes.
+class CustomerQueue
+{
+public:
+    CustomerQueue();
+   
+    bool empty() const { return m_size == 0; }
+    uint32_t size() const { return m_size; }
+    uint32_t front() const { return m_ring[m_head]; }
+    void push(uint32_t customer);
+    void pop();
+    void Save(Snapshot& snapshot) const;
+    void Load(Snapshot& snapshot);
+   
+private:
+    void Grow();
+   
+    std::vector<uint32_t> m_ring;
+    uint32_t m_head;
+    uint32_t m_size;
+};
+
+
+CustomerQueue::CustomerQueue()
+    : m_ring(64), m_head(0), m_size(0)
+{
+}
+
+
+void CustomerQueue::push(uint32_t customer)
+{
+    if (m_size == m_ring.size())
+    {
+        Grow();
+    }
+    m_ring[(m_head + m_size) & (m_ring.size() - 1)] = customer;
+    m_size++;
+}
+
+
+void CustomerQueue::pop()
+{
+    m_head = (m_head + 1) & (m_ring.size() - 1);
+    m_size--;
+}
+
+
+void CustomerQueue::Save(Snapshot& snapshot) const
+{
+    snapshot.PutVector(m_ring);
+    snapshot.Put(m_head);
+    snapshot.Put(m_size);
+}
+
+
+void CustomerQueue::Load(Snapshot& snapshot)
+{
+    snapshot.GetVector(m_ring);
+    snapshot.Get(m_head);
+    snapshot.Get(m_size);
+    if (m_ring.empty() || (m_ring.size() & (m_ring.size() - 1)) != 0 || m_size > m_ring.size())
+    {
+        *this = CustomerQueue();
+    }
+}
+
+
+void CustomerQueue::Grow()
+{
+    std::vector<uint32_t> ring(m_ring.size() * 2);
+    for (uint32_t i = 0; i < m_size; i++)
+    {
+        ring[i] = m_ring[(m_head + i) & (m_ring.size() - 1)];
+    }
+    m_ring.swap(ring);
+    m_head = 0;
+}
+
+
+// Little-endian columnar file that analysis tools can memory-map. The file
+// starts with the magic "SMCOL001", a uint32 column count and a uint32 of
+// zero, then one 32-byte descriptor per column: a NUL-padded name of 24
+// bytes, a uint32 type (0 = uint64, 1 = float64) and a uint32 of zero. Rows
+// follow in chunks, each a uint64 row count and then every column's values
+// for the chunk back to back, so each column of a chunk is one 8-byte-aligned
+// array. Rows are buffered by column and written a chunk at a time.
+class ColumnarWriter
+{
+public:
+    enum ColumnType
+    {
+        UINT64_COLUMN,
+        FLOAT64_COLUMN
+    };
+   
+    ColumnarWriter() : m_out(nullptr), m_owned(false), m_chunkRows(0), m_rows(0) {}
+    ~ColumnarWriter() { Close(); }
+    bool Open(const std::string& filename, const std::vector<std::pair<std::string, ColumnType>>& columns,
+              uint32_t chunkRows = 65536);
+    void Attach(FILE* out, const std::vector<std::pair<std::string, ColumnType>>& columns,
+                uint32_t chunkRows = 65536);
+    bool IsOpen() const { return m_out != nullptr; }
+    void Set(uint32_t column, uint64_t value) { m_columns[column][m_rows] = value; }
+    void Set(uint32_t column, double value) { std::memcpy(&m_columns[column][m_rows], &value, sizeof(value)); }
+    void EndRow();
+    void Close();
+   
+private:
+    void WriteChunk();
+   
+    FILE* m_out;
+    bool m_owned;
+    std::vector<std::vector<uint64_t>> m_columns;
+    uint32_t m_chunkRows;
+    uint32_t m_rows;
+};
+
+
+bool ColumnarWriter::Open(const std::string& filename,
+                          const std::vector<std::pair<std::string, ColumnType>>& columns, uint32_t chunkRows)
+{
+    const uint16_t probe = 1;
+    if (*reinterpret_cast<const uint8_t*>(&probe) != 1)
+    {
+        std::cerr << "Error: Columnar output needs a little-endian host" << std::endl;
+        return false;
+    }
+   
+    FILE* out = std::fopen(filename.c_str(), "wb");
+    if (out == nullptr)
+    {
+        std::cerr << "Error: Could not open " << filename << " for writing." << std::endl;
+        return false;
+    }
+   
+    Attach(out, columns, chunkRows);
+    m_owned = true;
+    return true;
+}
+
+
+// Writes to a stream the caller opened and closes, such as a pipe.
+void ColumnarWriter::Attach(FILE* out, const std::vector<std::pair<std::string, ColumnType>>& columns,
+                            uint32_t chunkRows)
+{
+    m_out = out;
+    m_owned = false;
+    uint32_t header[2] = {static_cast<uint32_t>(columns.size()), 0};
+    std::fwrite("SMCOL001", 1, 8, m_out);
+    std::fwrite(header, sizeof(header), 1, m_out);
+    for (auto& column : columns)
+    {
+        char name[24] = {};
+        std::strncpy(name, column.first.c_str(), sizeof(name) - 1);
+        uint32_t type[2] = {static_cast<uint32_t>(column.second), 0};
+        std::fwrite(name, sizeof(name), 1, m_out);
+        std::fwrite(type, sizeof(type), 1, m_out);
+    }
+   
+    m_chunkRows = chunkRows;
+    m_rows = 0;
+    m_columns.assign(columns.size(), std::vector<uint64_t>(chunkRows));
+}
+
+
+void ColumnarWriter::EndRow()
+{
+    m_rows++;
+    if (m_rows == m_chunkRows)
+    {
+        WriteChunk();
+    }
+}
+
+
+void ColumnarWriter::WriteChunk()
+{
+    uint64_t rows = m_rows;
+    std::fwrite(&rows, sizeof(rows), 1, m_out);
+    for (auto& column : m_columns)
+    {
+        std::fwrite(column.data(), sizeof(uint64_t), m_rows, m_out);
+    }
+    m_rows = 0;
+}
+
+
+void ColumnarWriter::Close()
+{
+    if (m_out != nullptr)
+    {
+        if (m_rows > 0)
+        {
+            WriteChunk();
+        }
+        if (m_owned)
+        {
+            std::fclose(m_out);
+        }
+        m_out = nullptr;
+    }
+}
+
+
+// Streams one record per served customer, so an audit trace costs file
+// space rather than memory. The simulation only copies records into a
+// fixed-size buffer; full buffers are handed to a background thread that
+// formats them, as text or as a ColumnarWriter file, and writes them out,
+// optionally through a compressor such as zstd. With two buffers the
+// simulation waits only if the disk falls a whole buffer behind.
+class CustomerTraceWriter
+{
+public:
+    CustomerTraceWriter();
+    ~CustomerTraceWriter() { Close(); }
+    bool Open(const std::string& filename, bool columnar = false, uint32_t sampleEvery = 1,
+              const std::string& compressor = "");
+    bool IsOpen() const { return m_out != nullptr; }
+    void Write(const Customer& customer);
+    void Close();
+   
+    static const uint32_t BUFFER_RECORDS = 16384;
+   
+private:
+    struct TraceRecord
+    {
+        uint64_t id;
+        double arrivalTime;
+        double serviceStartTime;
+        double serviceEndTime;
+    };
+   
+    void Submit();
+    void FlushLoop();
+    void Drain(const std::vector<TraceRecord>& records);
+   
+    FILE* m_out;
+    bool m_pipe;
+    bool m_columnarFormat;
+    ColumnarWriter m_columnar;
+    uint32_t m_sampleEvery;
+    uint64_t m_seen;
+   
+    std::vector<TraceRecord> m_active;
+    std::vector<TraceRecord> m_pending;
+    bool m_hasPending;
+    bool m_closing;
+    std::mutex m_mutex;
+    std::condition_variable m_changed;
+    std::thread m_thread;
+};
+
+
+CustomerTraceWriter::CustomerTraceWriter()
+    : m_out(nullptr), m_pipe(false), m_columnarFormat(false), m_sampleEvery(1), m_seen(0),
+      m_hasPending(false), m_closing(false)
+{
+}
+
+
+// Single-quotes text for /bin/sh, closing and reopening the quotes around
+// every quote inside it, so nothing in a file name is run as shell syntax.
+std::string ShellQuote(const std::string& text)
+{
+    std::string quoted = "'";
+    for (char c : text)
+    {
+        quoted += (c == '\'') ? std::string("'\\''") : std::string(1, c);
+    }
+    return quoted + "'";
+}
+
+
+// compressor is a shell command reading the trace on stdin and writing the
+// compressed stream to stdout, e.g. "zstd -q -c".
+bool CustomerTraceWriter::Open(const std::string& filename, bool columnar, uint32_t sampleEvery,
+                               const std::string& compressor)
+{
+    if (compressor.empty())
+    {
+        m_out = std::fopen(filename.c_str(), "wb");
+    }
+    else
+    {
+        std::string command = compressor + " > " + ShellQuote(filename);
+        m_out = popen(command.c_str(), "w");
+    }
+    if (m_out == nullptr)
+    {
+        std::cerr << "Error: Could not open customer trace " << filename << " for writing." << std::endl;
+        return false;
+    }
+   
+    m_pipe = !compressor.empty();
+    m_columnarFormat = columnar;
+    m_sampleEvery = std::max<uint32_t>(sampleEvery, 1);
+    m_seen = 0;
+    if (columnar)
+    {
+        m_columnar.Attach(m_out, {{"id", ColumnarWriter::UINT64_COLUMN},
+                                  {"arrival", ColumnarWriter::FLOAT64_COLUMN},
+                                  {"serviceStart", ColumnarWriter::FLOAT64_COLUMN},
+                                  {"serviceEnd", ColumnarWriter::FLOAT64_COLUMN},
+                                  {"waiting", ColumnarWriter::FLOAT64_COLUMN}});
+    }
+    else
+    {
+        std::fputs("# Id Arrival(s) ServiceStart(s) ServiceEnd(s) Waiting(s)\n", m_out);
+    }
+   
+    m_active.reserve(BUFFER_RECORDS);
+    m_pending.reserve(BUFFER_RECORDS);
+    m_hasPending = false;
+    m_closing = false;
+    m_thread = std::thread(&CustomerTraceWriter::FlushLoop, this);
+    return true;
+}
+
+
+void CustomerTraceWriter::Write(const Customer& customer)
+{
+    if (m_seen++ % m_sampleEvery != 0)
+    {
+        return;
+    }
+   
+    m_active.push_back({customer.id, customer.arrivalTime, customer.serviceStartTime, customer.serviceEndTime});
+    if (m_active.size() == BUFFER_RECORDS)
+    {
+        Submit();
+    }
+}
+
+
+void CustomerTraceWriter::Submit()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_changed.wait(lock, [this]() { return !m_hasPending; });
+    m_pending.swap(m_active);
+    m_hasPending = true;
+    m_changed.notify_all();
+}
+
+
+void CustomerTraceWriter::FlushLoop()
+{
+    std::vector<TraceRecord> records;
+    records.reserve(BUFFER_RECORDS);
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_changed.wait(lock, [this]() { return m_hasPending || m_closing; });
+            if (!m_hasPending)
+            {
+                return;
+            }
+            records.swap(m_pending);
+            m_hasPending = false;
+            m_changed.notify_all();
+        }
+        Drain(records);
+        records.clear();
+    }
+}
+
+
+void CustomerTraceWriter::Drain(const std::vector<TraceRecord>& records)
+{
+    if (m_columnarFormat)
+    {
+        for (auto& record : records)
+        {
+            m_columnar.Set(0, record.id);
+            m_columnar.Set(1, record.arrivalTime);
+            m_columnar.Set(2, record.serviceStartTime);
+            m_columnar.Set(3, record.serviceEndTime);
+            m_columnar.Set(4, record.serviceStartTime - record.arrivalTime);
+            m_columnar.EndRow();
+        }
+        return;
+    }
+   
+    char line[160];
+    for (auto& record : records)
+    {
+        int length = std::snprintf(line, sizeof(line), "%llu %.9f %.9f %.9f %.9f\n",
+                                   static_cast<unsigned long long>(record.id), record.arrivalTime,
+                                   record.serviceStartTime, record.serviceEndTime,
+                                   record.serviceStartTime - record.arrivalTime);
+        std::fwrite(line, 1, length, m_out);
+    }
+}
+
+
+void CustomerTraceWriter::Close()
+{
+    if (m_out == nullptr)
+    {
+        return;
+    }
+   
+    if (!m_active.empty())
+    {
+        Submit();
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closing = true;
+        m_changed.notify_all();
+    }
+    m_thread.join();
+   
+    m_columnar.Close();
+    if (m_pipe)
+    {
+        pclose(m_out);
+    }
+    else
+    {
+        std::fclose(m_out);
+    }
+    m_out = nullptr;
+}
+
+
+class CashierStore;
+
+
+// One cashier's slice of a CashierStore. It is two words and is made on
+// demand, so code reads like it works on a cashier object while the state
+// stays in the store's arrays.
+class Cashier
+{
+public:
+    Cashier(CashierStore& store, uint32_t id) : m_store(store), m_id(id) {}
+   
+    bool IsBusy() const;
+    bool IsOpen() const;
+    void Open(double currentTime);
+    void Close(double currentTime);
+    void StartService(uint32_t customer, double currentTime);
+    uint32_t EndService(double currentTime);
+    uint32_t GetCurrentCustomer() const;
+    double GetTotalServiceTime() const;
+    double GetTotalIdleTime() const;
+    double GetLastIdleTime() const;
+    uint32_t GetCustomersServed() const;
+   
+private:
+    CashierStore& m_store;
+    uint32_t m_id;
+};
+
+
+// Read-only slice of a const CashierStore, for reports.
+class ConstCashier
+{
+public:
+    ConstCashier(const CashierStore& store, uint32_t id) : m_store(store), m_id(id) {}
+   
+    bool IsBusy() const;
+    bool IsOpen() const;
+    double GetTotalServiceTime() const;
+    double GetTotalIdleTime() const;
+    uint32_t GetCustomersServed() const;
+   
+private:
+    const CashierStore& m_store;
+    uint32_t m_id;
+};
+
+
+// Every cashier's state as structure-of-arrays: busy and open flags in
+// bitsets and each statistic in its own contiguous array. With thousands of
+// cashiers a busy check is one word load rather than a pointer chase, and
+// the whole-store passes below run straight down the arrays.
+class CashierStore
+{
+public:
+    CashierStore(uint32_t numCashiers);
+   
+    uint32_t size() const { return m_currentCustomer.size(); }
+    Cashier operator[](uint32_t id) { return Cashier(*this, id); }
+    ConstCashier operator[](uint32_t id) const { return ConstCashier(*this, id); }
+    bool IsBusy(uint32_t id) const { return (m_busy[id / 64] >> (id % 64)) & 1; }
+    bool IsOpen(uint32_t id) const { return (m_open[id / 64] >> (id % 64)) & 1; }
+   
+    double GetTotalServiceTime() const;
+    double GetTotalIdleTime() const;
+    void ResetStatistics(double currentTime);
+    void FinalizeIdleTime(double currentTime);
+    template <typename Function>
+    void ForEachBusy(Function function) const;
+    void Save(Snapshot& snapshot) const;
+    void Load(Snapshot& snapshot);
+   
+private:
+    friend class Cashier;
+    friend class ConstCashier;
+   
+    void SetBusy(uint32_t id, bool busy)
+    {
+        m_busy[id / 64] = (m_busy[id / 64] & ~(1ULL << (id % 64))) | (static_cast<uint64_t>(busy) << (id % 64));
+    }
+    void SetOpen(uint32_t id, bool open)
+    {
+        m_open[id / 64] = (m_open[id / 64] & ~(1ULL << (id % 64))) | (static_cast<uint64_t>(open) << (id % 64));
+    }
+   
+    std::vector<uint64_t> m_busy;
+    std::vector<uint64_t> m_open;
+    std::vector<uint32_t> m_currentCustomer;
+    std::vector<double> m_serviceStartTime;
+    std::vector<double> m_totalServiceTime;
+    std::vector<double> m_totalIdleTime;
+    std::vector<double> m_lastIdleTime;
+    std::vector<double> m_lastActivityTime;
+    std::vector<uint32_t> m_customersServed;
+};
+
+
+CashierStore::CashierStore(uint32_t numCashiers)
+    : m_busy((numCashiers + 63) / 64, 0), m_open((numCashiers + 63) / 64, ~0ULL),
+      m_currentCustomer(numCashiers, NO_CUSTOMER), m_serviceStartTime(numCashiers, 0),
+      m_totalServiceTime(numCashiers, 0), m_totalIdleTime(numCashiers, 0), m_lastIdleTime(numCashiers, 0),
+      m_lastActivityTime(numCashiers, 0), m_customersServed(numCashiers, 0)
+{
+}
+
+
+// Summed in cashier order, as the per-cashier loop did, so results do not
+// change in the last bit.
+double CashierStore::GetTotalServiceTime() const
+{
+    double total = 0;
+    for (double serviceTime : m_totalServiceTime)
+    {
+        total += serviceTime;
+    }
+    return total;
+}
+
+
+double CashierStore::GetTotalIdleTime() const
+{
+    double total = 0;
+    for (double idleTime : m_totalIdleTime)
+    {
+        total += idleTime;
+    }
+    return total;
+}
+
+
+void CashierStore::ResetStatistics(double currentTime)
+{
+    uint32_t numCashiers = size();
+    std::fill(m_totalServiceTime.begin(), m_totalServiceTime.end(), 0.0);
+    std::fill(m_totalIdleTime.begin(), m_totalIdleTime.end(), 0.0);
+    std::fill(m_customersServed.begin(), m_customersServed.end(), 0);
+    std::fill(m_lastActivityTime.begin(), m_lastActivityTime.end(), currentTime);
+    for (uint32_t id = 0; id < numCashiers; id++)
+    {
+        m_serviceStartTime[id] = IsBusy(id) ? currentTime : m_serviceStartTime[id];
+    }
+}
+
+
+// Closes the books on every open, idle cashier at the end of a run.
+void CashierStore::FinalizeIdleTime(double currentTime)
+{
+    uint32_t numCashiers = size();
+    for (uint32_t id = 0; id < numCashiers; id++)
+    {
+        if (!IsOpen(id) || IsBusy(id))
+        {
+            continue;
+        }
+        if (m_lastActivityTime[id] > 0)
+        {
+            m_totalIdleTime[id] += (currentTime - m_lastActivityTime[id]);
+        }
+        else
+        {
+            m_totalIdleTime[id] = currentTime;
+        }
+    }
+}
+
+
+// Calls function(id) for each busy cashier in increasing id order, scanning
+// the bitset a word at a time. Cashiers function frees do not disturb the
+// scan.
+template <typename Function>
+void CashierStore::ForEachBusy(Function function) const
+{
+    for (uint32_t w = 0; w < m_busy.size(); w++)
+    {
+        uint64_t word = m_busy[w];
+        while (word != 0)
+        {
+            function(w * 64 + __builtin_ctzll(word));
+            word &= word - 1;
+        }
+    }
+}
+
+
+void CashierStore::Save(Snapshot& snapshot) const
+{
+    snapshot.PutVector(m_busy);
+    snapshot.PutVector(m_open);
+    snapshot.PutVector(m_currentCustomer);
+    snapshot.PutVector(m_serviceStartTime);
+    snapshot.PutVector(m_totalServiceTime);
+    snapshot.PutVector(m_totalIdleTime);
+    snapshot.PutVector(m_lastIdleTime);
+    snapshot.PutVector(m_lastActivityTime);
+    snapshot.PutVector(m_customersServed);
+}
+
+
+void CashierStore::Load(Snapshot& snapshot)
+{
+    snapshot.GetVector(m_busy);
+    snapshot.GetVector(m_open);
+    snapshot.GetVector(m_currentCustomer);
+    snapshot.GetVector(m_serviceStartTime);
+    snapshot.GetVector(m_totalServiceTime);
+    snapshot.GetVector(m_totalIdleTime);
+    snapshot.GetVector(m_lastIdleTime);
+    snapshot.GetVector(m_lastActivityTime);
+    snapshot.GetVector(m_customersServed);
+}
+
+
+bool Cashier::IsBusy() const
+{
+    return m_store.IsBusy(m_id);
+}
+
+
+bool Cashier::IsOpen() const
+{
+    return m_store.IsOpen(m_id);
+}
+
+
+uint32_t Cashier::GetCurrentCustomer() const
+{
+    return m_store.m_currentCustomer[m_id];
+}
+
+
+double Cashier::GetTotalServiceTime() const
+{
+    return m_store.m_totalServiceTime[m_id];
+}
+
+
+double Cashier::GetTotalIdleTime() const
+{
+    return m_store.m_totalIdleTime[m_id];
+}
+
+
+double Cashier::GetLastIdleTime() const
+{
+    return m_store.m_lastIdleTime[m_id];
+}
+
+
+uint32_t Cashier::GetCustomersServed() const
+{
+    return m_store.m_customersServed[m_id];
+}
+
+
+void Cashier::StartService(uint32_t customer, double currentTime)
+{
+    if (IsBusy())
+    {
+        NS_LOG_ERROR("Cashier " << m_id << " is already busy!");
+        return;
+    }
+   
+    double& lastActivityTime = m_store.m_lastActivityTime[m_id];
+    if (lastActivityTime > 0)
+    {
+        m_store.m_totalIdleTime[m_id] += (currentTime - lastActivityTime);
+        m_store.m_lastIdleTime[m_id] = (currentTime - lastActivityTime);
+    }
+    else if (lastActivityTime == 0)
+    {
+        m_store.m_totalIdleTime[m_id] += currentTime;
+        m_store.m_lastIdleTime[m_id] = currentTime;
+    }
+   
+    m_store.SetBusy(m_id, true);
+    m_store.m_currentCustomer[m_id] = customer;
+    m_store.m_serviceStartTime[m_id] = currentTime;
+    lastActivityTime = currentTime;
+}
+
+
+uint32_t Cashier::EndService(double currentTime)
+{
+    if (!IsBusy())
+    {
+        NS_LOG_ERROR("Cashier " << m_id << " is not busy!");
+        return NO_CUSTOMER;
+    }
+   
+    uint32_t completedCustomer = m_store.m_currentCustomer[m_id];
+    if (completedCustomer == NO_CUSTOMER)
+    {
+        NS_LOG_ERROR("Cashier " << m_id << " has no current customer!");
+        m_store.SetBusy(m_id, false);
+        return NO_CUSTOMER;
+    }
+   
+    m_store.m_totalServiceTime[m_id] += currentTime - m_store.m_serviceStartTime[m_id];
+    m_store.m_customersServed[m_id]++;
+    m_store.SetBusy(m_id, false);
+    m_store.m_currentCustomer[m_id] = NO_CUSTOMER;
+    m_store.m_lastActivityTime[m_id] = currentTime;
+    return completedCustomer;
+}
+
+
+// A closed lane accrues neither busy nor idle time, so utilization only
+// covers the time the lane was staffed.
+void Cashier::Open(double currentTime)
+{
+    m_store.SetOpen(m_id, true);
+    m_store.m_lastActivityTime[m_id] = currentTime;
+}
+
+
+void Cashier::Close(double currentTime)
+{
+    if (IsBusy())
+    {
+        NS_LOG_ERROR("Cashier " << m_id << " closed while busy!");
+        return;
+    }
+   
+    m_store.m_totalIdleTime[m_id] += (currentTime - m_store.m_lastActivityTime[m_id]);
+    m_store.SetOpen(m_id, false);
+}
+
+
+bool ConstCashier::IsBusy() const
+{
+    return m_store.IsBusy(m_id);
+}
+
+
+bool ConstCashier::IsOpen() const
+{
+    return m_store.IsOpen(m_id);
+}
+
+
+double ConstCashier::GetTotalServiceTime() const
+{
+    return m_store.m_totalServiceTime[m_id];
+}
+
+
+double ConstCashier::GetTotalIdleTime() const
+{
+    return m_store.m_totalIdleTime[m_id];
+}
+
+
+uint32_t ConstCashier::GetCustomersServed() const
+{
+    return m_store.m_customersServed[m_id];
+}
+
+
+// Set of cashiers with nobody to serve. Acquire() picks the one the next
+// arrival goes to, so the selection policy decides fairness between lanes.
+class IdleCashierPool
+{
+public:
+    virtual ~IdleCashierPool() {}
+    virtual void Reset(uint32_t numCashiers, uint32_t numIdle) = 0;
+    virtual bool Empty() const = 0;
+    virtual uint32_t Acquire() = 0;
+    virtual void Release(uint32_t cashierId) = 0;
+    virtual void Save(Snapshot& snapshot) const = 0;
+    virtual void Load(Snapshot& snapshot) = 0;
+};
+
+
+// Lowest-numbered idle cashier first, as the original linear scan did. Two
+// levels of 64-bit words make the lookup two find-first-set operations for
+// up to 4096 cashiers.
+class LowestIndexIdlePool : public IdleCashierPool
+{
+public:
+    void Reset(uint32_t numCashiers, uint32_t numIdle) override;
+    bool Empty() const override { return m_idleCount == 0; }
+    uint32_t Acquire() override;
+    void Release(uint32_t cashierId) override;
+    void Save(Snapshot& snapshot) const override
+    {
+        snapshot.PutVector(m_words);
+        snapshot.PutVector(m_summary);
+        snapshot.Put(m_idleCount);
+    }
+    void Load(Snapshot& snapshot) override
+    {
+        snapshot.GetVector(m_words);
+        snapshot.GetVector(m_summary);
+        snapshot.Get(m_idleCount);
+    }
+   
+private:
+    std::vector<uint64_t> m_words;
+    std::vector<uint64_t> m_summary;
+    uint32_t m_idleCount;
+};
+
+
+void LowestIndexIdlePool::Reset(uint32_t numCashiers, uint32_t numIdle)
+{
+    m_words.assign((numCashiers + 63) / 64, 0);
+    m_summary.assign((m_words.size() + 63) / 64, 0);
+    m_idleCount = 0;
+    for (uint32_t i = 0; i < numIdle; i++)
+    {
+        Release(i);
+    }
+}
+
+
+uint32_t LowestIndexIdlePool::Acquire()
+{
+    uint32_t s = 0;
+    while (m_summary[s] == 0)
+    {
+        s++;
+    }
+    uint32_t w = s * 64 + __builtin_ctzll(m_summary[s]);
+    uint32_t cashierId = w * 64 + __builtin_ctzll(m_words[w]);
+   
+    m_words[w] &= m_words[w] - 1;
+    if (m_words[w] == 0)
+    {
+        m_summary[s] &= ~(1ULL << (w % 64));
+    }
+    m_idleCount--;
+    return cashierId;
+}
+
+
+void LowestIndexIdlePool::Release(uint32_t cashierId)
+{
+    uint32_t w = cashierId / 64;
+    m_words[w] |= 1ULL << (cashierId % 64);
+    m_summary[w / 64] |= 1ULL << (w % 64);
+    m_idleCount++;
+}
+
+
+// Cashiers become idle in time order, so a FIFO of idle cashiers hands the
+// next arrival to whoever has waited longest, like a heap keyed by
+// idle-since time but in O(1).
+class LongestIdlePool : public IdleCashierPool
+{
+public:
+    void Reset(uint32_t numCashiers, uint32_t numIdle) override;
+    bool Empty() const override { return m_idle.empty(); }
+    uint32_t Acquire() override;
+    void Release(uint32_t cashierId) override { m_idle.push(cashierId); }
+    void Save(Snapshot& snapshot) const override { m_idle.Save(snapshot); }
+    void Load(Snapshot& snapshot) override { m_idle.Load(snapshot); }
+   
+private:
+    CustomerQueue m_idle;
+};
+
+
+void LongestIdlePool::Reset(uint32_t, uint32_t numIdle)
+{
+    m_idle = CustomerQueue();
+    for (uint32_t i = 0; i < numIdle; i++)
+    {
+        m_idle.push(i);
+    }
+}
+
+
+uint32_t LongestIdlePool::Acquire()
+{
+    uint32_t cashierId = m_idle.front();
+    m_idle.pop();
+    return cashierId;
+}
+
+
+// Most recently freed cashier first, which concentrates work on few lanes.
+class MostRecentIdlePool : public IdleCashierPool
+{
+public:
+    void Reset(uint32_t numCashiers, uint32_t numIdle) override;
+    bool Empty() const override { return m_idle.empty(); }
+    uint32_t Acquire() override;
+    void Release(uint32_t cashierId) override { m_idle.push_back(cashierId); }
+    void Save(Snapshot& snapshot) const override { snapshot.PutVector(m_idle); }
+    void Load(Snapshot& snapshot) override { snapshot.GetVector(m_idle); }
+   
+private:
+    std::vector<uint32_t> m_idle;
+};
+
+
+void MostRecentIdlePool::Reset(uint32_t numCashiers, uint32_t numIdle)
+{
+    m_idle.clear();
+    m_idle.reserve(numCashiers);
+    for (uint32_t i = numIdle; i > 0; i--)
+    {
+        m_idle.push_back(i - 1);
+    }
+}
+
+
+uint32_t MostRecentIdlePool::Acquire()
+{
+    uint32_t cashierId = m_idle.back();
+    m_idle.pop_back();
+    return cashierId;
+}
+
+
+std::unique_ptr<IdleCashierPool> CreateIdleCashierPool(const std::string& policy)
+{
+    if (policy == "lowest")
+    {
+        return std::unique_ptr<IdleCashierPool>(new LowestIndexIdlePool());
+    }
+    if (policy == "longest-idle")
+    {
+        return std::unique_ptr<IdleCashierPool>(new LongestIdlePool());
+    }
+    if (policy == "most-recent")
+    {
+        return std::unique_ptr<IdleCashierPool>(new MostRecentIdlePool());
+    }
+    return nullptr;
+}
+
+
+struct AnalyticResults
+{
+    uint32_t numCashiers;
+    bool stable;
+    double utilization;
+    double probabilityOfWaiting;
+    double avgWaitingTime;
+    double avgQueueLength;
+};
+
+
+// Closed-form steady state of the M/M/c queue the simulation models.
+// Erlang B is built up with its recurrence and converted to Erlang C, which
+// stays finite for the large cashier counts where factorials overflow.
+class ErlangCModel
+{
+public:
+    ErlangCModel(double arrivalRate, double serviceRate);
+    AnalyticResults Evaluate(uint32_t numCashiers) const;
+   
+private:
+    double m_arrivalRate;
+    double m_serviceRate;
+};
+
+
+ErlangCModel::ErlangCModel(double arrivalRate, double serviceRate)
+    : m_arrivalRate(arrivalRate), m_serviceRate(serviceRate)
+{
+}
+
+
+AnalyticResults ErlangCModel::Evaluate(uint32_t numCashiers) const
+{
+    double offeredLoad = m_arrivalRate / m_serviceRate;
+   
+    AnalyticResults results;
+    results.numCashiers = numCashiers;
+    results.utilization = offeredLoad / numCashiers;
+    results.stable = results.utilization < 1.0;
+    if (!results.stable)
+    {
+        results.utilization = 1.0;
+        results.probabilityOfWaiting = 1.0;
+        results.avgWaitingTime = std::numeric_limits<double>::infinity();
+        results.avgQueueLength = std::numeric_limits<double>::infinity();
+        return results;
+    }
+   
+    double erlangB = 1.0;
+    for (uint32_t k = 1; k <= numCashiers; k++)
+    {
+        erlangB = offeredLoad * erlangB / (k + offeredLoad * erlangB);
+    }
+    double erlangC = erlangB / (1.0 - results.utilization * (1.0 - erlangB));
+   
+    results.probabilityOfWaiting = erlangC;
+    results.avgWaitingTime = erlangC / (numCashiers * m_serviceRate - m_arrivalRate);
+    results.avgQueueLength = m_arrivalRate * results.avgWaitingTime;
+    return results;
+}
+
+
+// Produces blocks of variates. One virtual call fills a whole block, so the
+// per-draw cost of a VariateBuffer is an array read.
+class VariateSource
+{
+public:
+    virtual ~VariateSource() {}
+    virtual void Fill(double* values, uint32_t count) = 0;
+};
+
+
+// Draws from an ns-3 stream, so buffering leaves the sequence unchanged.
+class Ns3VariateSource : public VariateSource
+{
+public:
+    Ns3VariateSource(Ptr<RandomVariableStream> stream) : m_stream(stream) {}
+    void Fill(double* values, uint32_t count) override;
+   
+private:
+    Ptr<RandomVariableStream> m_stream;
+};
+
+
+void Ns3VariateSource::Fill(double* values, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        values[i] = m_stream->GetValue();
+    }
+}
+
+
+// xoshiro256** seeded through splitmix64 from the ns-3 seed, run number and
+// stream index, so each (seed, run, stream) gives its own reproducible
+// sequence independent of ns-3's MRG32k3a streams.
+class FastRng
+{
+public:
+    FastRng() { Seed(0, 0, 0); }
+    void Seed(uint64_t seed, uint64_t run, uint64_t stream);
+   
+    uint64_t NextU64()
+    {
+        uint64_t result = Rotl(m_state[1] * 5, 7) * 9;
+        uint64_t t = m_state[1] << 17;
+        m_state[2] ^= m_state[0];
+        m_state[3] ^= m_state[1];
+        m_state[1] ^= m_state[2];
+        m_state[0] ^= m_state[3];
+        m_state[2] ^= t;
+        m_state[3] = Rotl(m_state[3], 45);
+        return result;
+    }
+   
+    // Uniform on (0, 1], so the result can go straight into log().
+    double NextUniform() { return ((NextU64() >> 11) + 1) * (1.0 / 9007199254740992.0); }
+   
+    uint64_t m_state[4];
+   
+private:
+    static uint64_t Rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+};
+
+
+void FastRng::Seed(uint64_t seed, uint64_t run, uint64_t stream)
+{
+    uint64_t x = seed * 0x9E3779B97F4A7C15ULL ^ run * 0xC2B2AE3D27D4EB4FULL ^ stream * 0x165667B19E3779F9ULL;
+    for (int i = 0; i < 4; i++)
+    {
+        x += 0x9E3779B97F4A7C15ULL;
+        uint64_t z = x;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        m_state[i] = z ^ (z >> 31);
+    }
+}
+
+
+// Replaces each uniform in (0, 1] with -mean * log(u). The logarithm is
+// computed without branches or libm calls (exponent split plus an atanh
+// series, within a few ulp of std::log) so the loop auto-vectorizes.
+void ExponentialFromUniform(double* values, uint32_t count, double mean)
+{
+    const double sqrtHalf = 0.70710678118654752440;
+    const double ln2 = 0.69314718055994530942;
+   
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint64_t bits;
+        std::memcpy(&bits, &values[i], sizeof(bits));
+        uint64_t exponentBits = (bits >> 52) | 0x4330000000000000ULL;
+        double exponent;
+        std::memcpy(&exponent, &exponentBits, sizeof(exponent));
+        exponent -= 4503599627370496.0 + 1022.0;
+       
+        uint64_t mantissaBits = (bits & 0x000FFFFFFFFFFFFFULL) | 0x3FE0000000000000ULL;
+        double m;
+        std::memcpy(&m, &mantissaBits, sizeof(m));
+        double adjust = (m < sqrtHalf) ? 1.0 : 0.0;
+        m += m * adjust;
+        exponent -= adjust;
+       
+        double s = (m - 1.0) / (m + 1.0);
+        double s2 = s * s;
+        double p = 1.0 / 19;
+        p = p * s2 + 1.0 / 17;
+        p = p * s2 + 1.0 / 15;
+        p = p * s2 + 1.0 / 13;
+        p = p * s2 + 1.0 / 11;
+        p = p * s2 + 1.0 / 9;
+        p = p * s2 + 1.0 / 7;
+        p = p * s2 + 1.0 / 5;
+        p = p * s2 + 1.0 / 3;
+        p = p * s2 + 1.0;
+        values[i] = -mean * (exponent * ln2 + 2.0 * s * p);
+    }
+}
+
+
+class FastExponentialSource : public VariateSource
+{
+public:
+    FastExponentialSource(double mean, int64_t stream);
+    void Fill(double* values, uint32_t count) override;
+   
+private:
+    double m_mean;
+    FastRng m_rng;
+};
+
+
+FastExponentialSource::FastExponentialSource(double mean, int64_t stream)
+    : m_mean(mean)
+{
+    m_rng.Seed(RngSeedManager::GetSeed(), RngSeedManager::GetRun(), stream);
+}
+
+
+void FastExponentialSource::Fill(double* values, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        values[i] = m_rng.NextUniform();
+    }
+    ExponentialFromUniform(values, count, m_mean);
+}
+
+
+// Distribution policies for DistributionSource. Each has an inline
+// Sample(FastRng&), so a block fill is one tight loop with no virtual call
+// per draw.
+struct ExponentialDistribution
+{
+    double mean;
+   
+    double Sample(FastRng& rng) { return -mean * std::log(rng.NextUniform()); }
+};
+
+
+// Sum of k exponential phases. Uniforms are multiplied in groups of 16 before
+// taking a logarithm, which cannot underflow (16 * 53 bits < 1022).
+struct ErlangDistribution
+{
+    uint32_t phases;
+    double phaseMean;
+   
+    double Sample(FastRng& rng)
+    {
+        double logSum = 0;
+        uint32_t remaining = phases;
+        while (remaining > 0)
+        {
+            uint32_t group = std::min<uint32_t>(remaining, 16);
+            double product = 1.0;
+            for (uint32_t i = 0; i < group; i++)
+            {
+                product *= rng.NextUniform();
+            }
+            logSum += std::log(product);
+            remaining -= group;
+        }
+        return -phaseMean * logSum;
+    }
+};
+
+
+// Box-Muller normals, using both values of each pair.
+struct LogNormalDistribution
+{
+    double mu;
+    double sigma;
+    bool hasSpare;
+    double spare;
+   
+    double Sample(FastRng& rng)
+    {
+        double z;
+        if (hasSpare)
+        {
+            z = spare;
+            hasSpare = false;
+        }
+        else
+        {
+            double radius = std::sqrt(-2.0 * std::log(rng.NextUniform()));
+            double angle = 2.0 * M_PI * rng.NextUniform();
+            z = radius * std::cos(angle);
+            spare = radius * std::sin(angle);
+            hasSpare = true;
+        }
+        return std::exp(mu + sigma * z);
+    }
+};
+
+
+struct DeterministicDistribution
+{
+    double value;
+   
+    double Sample(FastRng&) { return value; }
+};
+
+
+// Histogram of bins (lower edge, upper edge, weight) with Vose's alias
+// table, loaded once and shared by every source sampling it.
+struct EmpiricalTable
+{
+    std::vector<double> lower;
+    std::vector<double> width;
+    std::vector<double> probability;
+    std::vector<uint32_t> alias;
+   
+    bool Load(const std::string& filename);
+};
+
+
+// Samples uniformly within a bin picked in O(1) from the alias table.
+struct EmpiricalDistribution
+{
+    std::shared_ptr<const EmpiricalTable> table;
+   
+    double Sample(FastRng& rng)
+    {
+        const EmpiricalTable& bins = *table;
+        double column = rng.NextUniform() * bins.lower.size();
+        uint32_t bin = std::min<uint32_t>(static_cast<uint32_t>(column), bins.lower.size() - 1);
+        if (column - bin > bins.probability[bin])
+        {
+            bin = bins.alias[bin];
+        }
+        return bins.lower[bin] + bins.width[bin] * (1.0 - rng.NextUniform());
+    }
+};
+
+
+bool EmpiricalTable::Load(const std::string& filename)
+{
+    std::ifstream in(filename);
+    if (!in.is_open())
+    {
+        std::cerr << "Error: Could not open histogram file " << filename << std::endl;
+        return false;
+    }
+   
+    std::vector<double> weights;
+    double totalWeight = 0;
+    std::string line;
+    while (std::getline(in, line))
+    {
+        if (line.empty() || line[0] == '#')
+        {
+            continue;
+        }
+        std::istringstream fields(line);
+        double low, high, weight;
+        if (!(fields >> low >> high >> weight) || high < low || weight < 0)
+        {
+            std::cerr << "Error: Bad histogram line in " << filename << ": " << line << std::endl;
+            return false;
+        }
+        lower.push_back(low);
+        width.push_back(high - low);
+        weights.push_back(weight);
+        totalWeight += weight;
+    }
+    if (weights.empty() || totalWeight <= 0)
+    {
+        std::cerr << "Error: Histogram file " << filename << " has no weighted bins" << std::endl;
+        return false;
+    }
+   
+    uint32_t n = weights.size();
+    probability.assign(n, 1.0);
+    alias.resize(n);
+    std::vector<double> scaled(n);
+    std::vector<uint32_t> small;
+    std::vector<uint32_t> large;
+    for (uint32_t i = 0; i < n; i++)
+    {
+        alias[i] = i;
+        scaled[i] = weights[i] * n / totalWeight;
+        (scaled[i] < 1.0 ? small : large).push_back(i);
+    }
+    while (!small.empty() && !large.empty())
+    {
+        uint32_t s = small.back();
+        small.pop_back();
+        uint32_t l = large.back();
+        probability[s] = scaled[s];
+        alias[s] = l;
+        scaled[l] -= 1.0 - scaled[s];
+        if (scaled[l] < 1.0)
+        {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+    return true;
+}
+
+
+template <typename Distribution>
+class DistributionSource : public VariateSource
+{
+public:
+    DistributionSource(const Distribution& distribution, int64_t stream);
+    void Fill(double* values, uint32_t count) override;
+   
+private:
+    Distribution m_distribution;
+    FastRng m_rng;
+};
+
+
+template <typename Distribution>
+DistributionSource<Distribution>::DistributionSource(const Distribution& distribution, int64_t stream)
+    : m_distribution(distribution)
+{
+    m_rng.Seed(RngSeedManager::GetSeed(), RngSeedManager::GetRun(), stream);
+}
+
+
+template <typename Distribution>
+void DistributionSource<Distribution>::Fill(double* values, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        values[i] = m_distribution.Sample(m_rng);
+    }
+}
+
+
+// Exponential blocks use the vectorized kernel rather than one log per draw.
+template <>
+void DistributionSource<ExponentialDistribution>::Fill(double* values, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        values[i] = m_rng.NextUniform();
+    }
+    ExponentialFromUniform(values, count, m_distribution.mean);
+}
+
+
+// A parsed "exponential", "erlang:K", "lognormal:CV", "deterministic" or
+// "empirical:FILE" value. K is the number of phases and CV the coefficient
+// of variation; an empirical histogram is read here, once.
+struct DistributionSpec
+{
+    std::string name;
+    uint32_t phases;
+    double cv;
+    std::shared_ptr<const EmpiricalTable> histogram;
+};
+
+
+// Returns null and prints why if the spec is not usable.
+std::shared_ptr<const DistributionSpec> ParseDistribution(const std::string& spec)
+{
+    std::shared_ptr<DistributionSpec> parsed = std::make_shared<DistributionSpec>();
+    parsed->name = spec.substr(0, spec.find(':'));
+    std::string argument = (spec.find(':') != std::string::npos) ? spec.substr(spec.find(':') + 1) : "";
+    parsed->phases = 0;
+    parsed->cv = 0;
+   
+    if (parsed->name == "exponential" || parsed->name == "deterministic")
+    {
+        return parsed;
+    }
+    if (parsed->name == "erlang")
+    {
+        parsed->phases = argument.empty() ? 2 : std::strtoul(argument.c_str(), nullptr, 10);
+        if (parsed->phases == 0)
+        {
+            std::cerr << "Error: Erlang distribution needs at least one phase: " << spec << std::endl;
+            return nullptr;
+        }
+        return parsed;
+    }
+    if (parsed->name == "lognormal")
+    {
+        parsed->cv = argument.empty() ? 1.0 : std::strtod(argument.c_str(), nullptr);
+        if (parsed->cv <= 0)
+        {
+            std::cerr << "Error: Lognormal distribution needs a positive CV: " << spec << std::endl;
+            return nullptr;
+        }
+        return parsed;
+    }
+    if (parsed->name == "empirical")
+    {
+        std::shared_ptr<EmpiricalTable> histogram = std::make_shared<EmpiricalTable>();
+        if (!histogram->Load(argument))
+        {
+            return nullptr;
+        }
+        parsed->histogram = histogram;
+        return parsed;
+    }
+   
+    std::cerr << "Error: Unknown distribution '" << spec << "'" << std::endl;
+    return nullptr;
+}
+
+
+// Erlang-C, and everything built on it, holds for M/M/c only.
+bool IsExponential(const std::shared_ptr<const DistributionSpec>& arrivals,
+                   const std::shared_ptr<const DistributionSpec>& service)
+{
+    return (!arrivals || arrivals->name == "exponential") && (!service || service->name == "exponential");
+}
+
+
+// All but the empirical histogram keep the given mean.
+std::unique_ptr<VariateSource> CreateDistributionSource(const DistributionSpec& spec, double mean, int64_t stream)
+{
+    if (spec.name == "erlang")
+    {
+        ErlangDistribution distribution = {spec.phases, mean / spec.phases};
+        return std::unique_ptr<VariateSource>(new DistributionSource<ErlangDistribution>(distribution, stream));
+    }
+    if (spec.name == "lognormal")
+    {
+        double sigma2 = std::log(1.0 + spec.cv * spec.cv);
+        LogNormalDistribution distribution = {std::log(mean) - sigma2 / 2, std::sqrt(sigma2), false, 0};
+        return std::unique_ptr<VariateSource>(new DistributionSource<LogNormalDistribution>(distribution, stream));
+    }
+    if (spec.name == "deterministic")
+    {
+        DeterministicDistribution distribution = {mean};
+        return std::unique_ptr<VariateSource>(new DistributionSource<DeterministicDistribution>(distribution, stream));
+    }
+    if (spec.name == "empirical")
+    {
+        EmpiricalDistribution distribution = {spec.histogram};
+        return std::unique_ptr<VariateSource>(new DistributionSource<EmpiricalDistribution>(distribution, stream));
+    }
+    ExponentialDistribution distribution = {mean};
+    return std::unique_ptr<VariateSource>(new DistributionSource<ExponentialDistribution>(distribution, stream));
+}
+
+
+// Ring of pre-generated variates handed out one at a time and refilled a
+// block at a time from its source.
+class VariateBuffer
+{
+public:
+    static constexpr uint32_t BLOCK_SIZE = 1024;
+   
+    VariateBuffer() : m_block(SpareStorage<double>::Take()), m_next(BLOCK_SIZE), m_fills(0)
+    {
+        m_block.resize(BLOCK_SIZE);
+    }
+    ~VariateBuffer() { SpareStorage<double>::Return(m_block); }
+   
+    void SetSource(std::unique_ptr<VariateSource> source)
+    {
+        m_source = std::move(source);
+        m_next = BLOCK_SIZE;
+        m_fills = 0;
+    }
+   
+    double Next()
+    {
+        if (m_next == BLOCK_SIZE)
+        {
+            m_source->Fill(m_block.data(), BLOCK_SIZE);
+            m_next = 0;
+            m_fills++;
+        }
+        return m_block[m_next++];
+    }
+   
+    // Counted per block, so it costs nothing per draw.
+    uint64_t GetDrawCount() const { return m_fills * BLOCK_SIZE - (BLOCK_SIZE - m_next) * (m_fills > 0); }
+   
+    // The position is saved as blocks drawn, which works for every source,
+    // ns-3 streams included. Loading it into a buffer with a fresh source
+    // regenerates those blocks, which costs far less than the events that
+    // consumed them.
+    void Save(Snapshot& snapshot) const
+    {
+        snapshot.Put(m_fills);
+        snapshot.Put(m_next);
+    }
+    void Load(Snapshot& snapshot)
+    {
+        uint64_t fills = 0;
+        uint32_t next = BLOCK_SIZE;
+        snapshot.Get(fills);
+        snapshot.Get(next);
+        for (uint64_t i = 0; i < fills; i++)
+        {
+            m_source->Fill(m_block.data(), BLOCK_SIZE);
+        }
+        m_fills = fills;
+        m_next = std::min(next, BLOCK_SIZE);
+    }
+   
+private:
+    std::unique_ptr<VariateSource> m_source;
+    std::vector<double> m_block;
+    uint32_t m_next;
+    uint64_t m_fills;
+};
+
+
+// Lengths (queued plus in service) of a contiguous range of lanes, kept in
+// buckets by length. A lane's length changes by one per arrival or
+// departure, so moving it between neighbouring buckets and tracking the
+// shortest non-empty bucket is O(1) however many lanes there are.
+class LaneLengthIndex
+{
+public:
+    void Reset(uint32_t firstLane, uint32_t numLanes);
+    bool Empty() const { return m_length.empty(); }
+    bool Contains(uint32_t lane) const { return lane - m_firstLane < m_length.size(); }
+    uint32_t GetLength(uint32_t lane) const { return m_length[lane - m_firstLane]; }
+    uint32_t GetShortestLength() const { return m_shortest; }
+    uint32_t Shortest() const { return m_firstLane + m_buckets[m_shortest].back(); }
+    void Increment(uint32_t lane);
+    void Decrement(uint32_t lane);
+   
+private:
+    void Move(uint32_t local, uint32_t length);
+   
+    uint32_t m_firstLane;
+    std::vector<uint32_t> m_length;
+    std::vector<uint32_t> m_position;
+    std::vector<std::vector<uint32_t>> m_buckets;
+    uint32_t m_shortest;
+};
+
+
+void LaneLengthIndex::Reset(uint32_t firstLane, uint32_t numLanes)
+{
+    m_firstLane = firstLane;
+    m_length.assign(numLanes, 0);
+    m_position.resize(numLanes);
+    m_buckets.assign(1, std::vector<uint32_t>());
+    for (uint32_t i = numLanes; i > 0; i--)
+    {
+        m_position[i - 1] = m_buckets[0].size();
+        m_buckets[0].push_back(i - 1);
+    }
+    m_shortest = 0;
+}
+
+
+void LaneLengthIndex::Increment(uint32_t lane)
+{
+    uint32_t local = lane - m_firstLane;
+    uint32_t length = m_length[local];
+    Move(local, length + 1);
+    if (m_shortest == length && m_buckets[length].empty())
+    {
+        m_shortest = length + 1;
+    }
+}
+
+
+void LaneLengthIndex::Decrement(uint32_t lane)
+{
+    uint32_t local = lane - m_firstLane;
+    uint32_t length = m_length[local];
+    Move(local, length - 1);
+    m_shortest = std::min(m_shortest, length - 1);
+}
+
+
+void LaneLengthIndex::Move(uint32_t local, uint32_t length)
+{
+    std::vector<uint32_t>& from = m_buckets[m_length[local]];
+    uint32_t last = from.back();
+    from[m_position[local]] = last;
+    m_position[last] = m_position[local];
+    from.pop_back();
+   
+    if (length >= m_buckets.size())
+    {
+        m_buckets.resize(length + 1);
+    }
+    m_position[local] = m_buckets[length].size();
+    m_buckets[length].push_back(local);
+    m_length[local] = length;
+}
+
+
+// Routing draws come from their own FastRng stream, offset well past the
+// variate streams so they never share one.
+const uint64_t ROUTING_STREAM = 1ULL << 32;
+const uint64_t CHECKPOINT_CHECK_EVENTS = 65536;
+const int64_t BRANCH_STREAM = 1LL << 40;
+const uint64_t CLASS_STREAM = 1ULL << 33;
+
+
+// When a waiting customer gives up. Entries are never removed early: one
+// whose customer has started service, or whose slot now holds someone else,
+// is simply skipped when it reaches the top of the heap.
+struct PatienceDeadline
+{
+    double time;
+    uint32_t customer;
+    uint32_t id;
+   
+    bool operator>(const PatienceDeadline& other) const { return time > other.time; }
+};
+
+
+// How an arrival picks a lane when every cashier has its own queue.
+enum LaneRouting
+{
+    JSQ_ROUTING,
+    RANDOM_ROUTING,
+    POWER_OF_TWO_ROUTING
+};
+
+
+// "pooled" is the single queue feeding every idle cashier; "lanes" gives
+// each cashier its own queue and routes arrivals with jsq (shortest lane),
+// random or power-of-two (shorter of two random lanes). Returns false if
+// either name is unknown.
+bool ParseTopology(const std::string& topology, const std::string& routing, bool& laneQueues,
+                   LaneRouting& laneRouting)
+{
+    if (topology != "pooled" && topology != "lanes")
+    {
+        return false;
+    }
+   
+    if (routing == "jsq")
+    {
+        laneRouting = JSQ_ROUTING;
+    }
+    else if (routing == "random")
+    {
+        laneRouting = RANDOM_ROUTING;
+    }
+    else if (routing == "power-of-two")
+    {
+        laneRouting = POWER_OF_TWO_ROUTING;
+    }
+    else
+    {
+        return false;
+    }
+    laneQueues = (topology == "lanes");
+    return true;
+}
+
+
+class SupermarketSimulation;
+
+
+// Every pending event of the model lives in a slot: one per cashier for its
+// service end, followed by the control events below. A slot holds at most
+// one event, and scheduling an occupied slot replaces its event.
+enum ControlEvent
+{
+    ARRIVAL_EVENT,
+    WARMUP_EVENT,
+    STOP_EVENT,
+    STAFFING_EVENT,
+    BRANCH_EVENT,
+    NUM_CONTROL_EVENTS
+};
+
+
+class EventEngine
+{
+public:
+    virtual ~EventEngine() {}
+    virtual void Reset(SupermarketSimulation* sim, uint32_t numSlots) = 0;
+    virtual double Now() const = 0;
+    virtual void Schedule(uint32_t slot, double delay) = 0;
+    virtual void Cancel(uint32_t slot) = 0;
+    virtual void Run() = 0;
+    virtual void Stop() = 0;
+    uint64_t GetScheduleCount() const { return m_schedules; }
+    uint64_t GetCancelCount() const { return m_cancels; }
+    // Pending events and the clock; engines that cannot restore them return false.
+    virtual bool Save(Snapshot&) const { return false; }
+    virtual bool Load(Snapshot&) { return false; }
+   
+protected:
+    EventEngine() : m_schedules(0), m_cancels(0) {}
+   
+    uint64_t m_schedules;
+    uint64_t m_cancels;
+};
+
+
+// Drives the model through the ns-3 Simulator singleton.
+class Ns3EventEngine : public EventEngine
+{
+public:
+    void Reset(SupermarketSimulation* sim, uint32_t numSlots) override;
+    double Now() const override { return Simulator::Now().GetSeconds(); }
+    void Schedule(uint32_t slot, double delay) override;
+    void Cancel(uint32_t slot) override;
+    void Run() override { Simulator::Run(); }
+    void Stop() override;
+   
+private:
+    void Fire(uint32_t slot);
+   
+    SupermarketSimulation* m_sim;
+    std::vector<EventId> m_events;
+};
+
+
+// Specialized calendar for this model. With at most one event per slot, an
+// indexed binary heap over the slots replaces ns-3's general scheduler, and
+// events carry no allocation or callback. Timestamps are integer nanoseconds
+// and ties go to the earlier-scheduled event, as in ns-3 at its default time
+// resolution, so both engines process the same events in the same order.
+class CalendarEventEngine : public EventEngine
+{
+public:
+    CalendarEventEngine();
+    ~CalendarEventEngine() override;
+   
+    void Reset(SupermarketSimulation* sim, uint32_t numSlots) override;
+    double Now() const override { return m_now / 1e9; }
+    void Schedule(uint32_t slot, double delay) override;
+    void Cancel(uint32_t slot) override;
+    void Run() override;
+    void Stop() override;
+    bool Save(Snapshot& snapshot) const override;
+    bool Load(Snapshot& snapshot) override;
+   
+private:
+    static constexpr uint32_t NOT_SCHEDULED = std::numeric_limits<uint32_t>::max();
+   
+    bool Earlier(uint32_t a, uint32_t b) const
+    {
+        return m_time[a] < m_time[b] || (m_time[a] == m_time[b] && m_sequence[a] < m_sequence[b]);
+    }
+    void SiftUp(uint32_t index);
+    void SiftDown(uint32_t index);
+    void Place(uint32_t index, uint32_t slot);
+    void RemoveAt(uint32_t index);
+   
+    SupermarketSimulation* m_sim;
+    int64_t m_now;
+    uint64_t m_nextSequence;
+    bool m_stopped;
+    std::vector<int64_t> m_time;
+    std::vector<uint64_t> m_sequence;
+    std::vector<uint32_t> m_position;
+    std::vector<uint32_t> m_heap;
+};
+
+
+CalendarEventEngine::CalendarEventEngine()
+    : m_sim(nullptr), m_now(0), m_nextSequence(0), m_stopped(false), m_time(SpareStorage<int64_t>::Take()),
+      m_sequence(SpareStorage<uint64_t>::Take()), m_position(SpareStorage<uint32_t>::Take()),
+      m_heap(SpareStorage<uint32_t>::Take())
+{
+}
+
+
+CalendarEventEngine::~CalendarEventEngine()
+{
+    SpareStorage<int64_t>::Return(m_time);
+    SpareStorage<uint64_t>::Return(m_sequence);
+    SpareStorage<uint32_t>::Return(m_position);
+    SpareStorage<uint32_t>::Return(m_heap);
+}
+
+
+void CalendarEventEngine::Reset(SupermarketSimulation* sim, uint32_t numSlots)
+{
+    m_sim = sim;
+    m_now = 0;
+    m_nextSequence = 0;
+    m_stopped = false;
+    m_time.assign(numSlots, 0);
+    m_sequence.assign(numSlots, 0);
+    m_position.assign(numSlots, NOT_SCHEDULED);
+    m_heap.clear();
+    m_heap.reserve(numSlots);
+}
+
+
+void CalendarEventEngine::Place(uint32_t index, uint32_t slot)
+{
+    m_heap[index] = slot;
+    m_position[slot] = index;
+}
+
+
+void CalendarEventEngine::SiftUp(uint32_t index)
+{
+    uint32_t slot = m_heap[index];
+    while (index > 0)
+    {
+        uint32_t parent = (index - 1) / 2;
+        if (!Earlier(slot, m_heap[parent]))
+        {
+            break;
+        }
+        Place(index, m_heap[parent]);
+        index = parent;
+    }
+    Place(index, slot);
+}
+
+
+void CalendarEventEngine::SiftDown(uint32_t index)
+{
+    uint32_t slot = m_heap[index];
+    uint32_t size = m_heap.size();
+    while (true)
+    {
+        uint32_t child = 2 * index + 1;
+        if (child >= size)
+        {
+            break;
+        }
+        if (child + 1 < size && Earlier(m_heap[child + 1], m_heap[child]))
+        {
+            child++;
+        }
+        if (!Earlier(m_heap[child], slot))
+        {
+            break;
+        }
+        Place(index, m_heap[child]);
+        index = child;
+    }
+    Place(index, slot);
+}
+
+
+void CalendarEventEngine::RemoveAt(uint32_t index)
+{
+    uint32_t slot = m_heap[index];
+    uint32_t last = m_heap.back();
+    m_heap.pop_back();
+    m_position[slot] = NOT_SCHEDULED;
+    if (index < m_heap.size())
+    {
+        Place(index, last);
+        SiftDown(index);
+        SiftUp(m_position[last]);
+    }
+}
+
+
+void CalendarEventEngine::Schedule(uint32_t slot, double delay)
+{
+    if (INSTRUMENTATION_ENABLED)
+    {
+        m_schedules++;
+    }
+    m_time[slot] = m_now + std::llround(delay * 1e9);
+    m_sequence[slot] = m_nextSequence++;
+    if (m_position[slot] == NOT_SCHEDULED)
+    {
+        m_heap.push_back(slot);
+        SiftUp(m_heap.size() - 1);
+    }
+    else
+    {
+        SiftDown(m_position[slot]);
+        SiftUp(m_position[slot]);
+    }
+}
+
+
+void CalendarEventEngine::Cancel(uint32_t slot)
+{
+    if (m_position[slot] != NOT_SCHEDULED)
+    {
+        if (INSTRUMENTATION_ENABLED)
+        {
+            m_cancels++;
+        }
+        RemoveAt(m_position[slot]);
+    }
+}
+
+
+void CalendarEventEngine::Stop()
+{
+    for (uint32_t slot : m_heap)
+    {
+        m_position[slot] = NOT_SCHEDULED;
+    }
+    m_heap.clear();
+    m_stopped = true;
+}
+
+
+bool CalendarEventEngine::Save(Snapshot& snapshot) const
+{
+    snapshot.Put(m_now);
+    snapshot.Put(m_nextSequence);
+    snapshot.Put(m_schedules);
+    snapshot.Put(m_cancels);
+    snapshot.PutVector(m_time);
+    snapshot.PutVector(m_sequence);
+    snapshot.PutVector(m_position);
+    snapshot.PutVector(m_heap);
+    return true;
+}
+
+
+bool CalendarEventEngine::Load(Snapshot& snapshot)
+{
+    size_t numSlots = m_time.size();
+    snapshot.Get(m_now);
+    snapshot.Get(m_nextSequence);
+    snapshot.Get(m_schedules);
+    snapshot.Get(m_cancels);
+    snapshot.GetVector(m_time);
+    snapshot.GetVector(m_sequence);
+    snapshot.GetVector(m_position);
+    snapshot.GetVector(m_heap);
+    return snapshot.IsValid() && m_time.size() == numSlots && m_sequence.size() == numSlots &&
+           m_position.size() == numSlots && m_heap.size() <= numSlots;
+}
+
+
+std::unique_ptr<EventEngine> CreateEventEngine(const std::string& engine)
+{
+    if (engine == "ns3")
+    {
+        return std::unique_ptr<EventEngine>(new Ns3EventEngine());
+    }
+    if (engine == "calendar")
+    {
+        return std::unique_ptr<EventEngine>(new CalendarEventEngine());
+    }
+    return nullptr;
+}
+
+
+// Smallest cashier count whose Erlang-C mean wait is within targetWait, or
+// whose utilization is inside the recommendation band without a target.
+uint32_t RequiredCashiers(double arrivalRate, double serviceRate, double targetWait)
+{
+    if (arrivalRate <= 0)
+    {
+        return 0;
+    }
+   
+    ErlangCModel model(arrivalRate, serviceRate);
+    uint32_t numCashiers = std::max<uint32_t>(1, static_cast<uint32_t>(std::ceil(arrivalRate / serviceRate)));
+    while (true)
+    {
+        AnalyticResults analytic = model.Evaluate(numCashiers);
+        if (analytic.stable && ((targetWait > 0) ? analytic.avgWaitingTime <= targetWait :
+                                                   analytic.utilization <= DEFAULT_MAX_UTILIZATION))
+        {
+            return numCashiers;
+        }
+        numCashiers++;
+    }
+}
+
+
+// Piecewise-constant arrival rate over simulated time, e.g. 15-minute
+// buckets. Arrivals are generated by inverting the integrated rate: a
+// unit-mean interarrival draw is spent bucket by bucket from the current
+// time, so each arrival costs O(1) amortized and nothing is rejected
+// however far the off-peak rate is below the peak.
+class ArrivalRateSchedule
+{
+public:
+    bool Load(const std::string& filename);
+    uint32_t GetBucketCount() const { return m_start.size(); }
+    double GetBucketStart(uint32_t bucket) const { return m_start[bucket]; }
+    double GetBucketRate(uint32_t bucket) const { return m_rate[bucket]; }
+    double GetBucketEnd(uint32_t bucket, double endTime) const;
+    uint32_t FindBucket(double time) const;
+    double ExpectedArrivals(double endTime) const;
+    double NextArrival(double currentTime, double work, uint32_t& bucket) const;
+   
+private:
+    std::vector<double> m_start;
+    std::vector<double> m_rate;
+};
+
+
+// Each line holds a bucket start time and the rate from then on, separated
+// by a comma or whitespace: "0,1.5". The rate before the first start is 0
+// and the last rate holds until the end of the run.
+bool ArrivalRateSchedule::Load(const std::string& filename)
+{
+    std::ifstream in(filename);
+    if (!in.is_open())
+    {
+        std::cerr << "Error: Could not open arrival schedule " << filename << std::endl;
+        return false;
+    }
+   
+    std::string line;
+    while (std::getline(in, line))
+    {
+        if (line.empty() || line[0] == '#')
+        {
+            continue;
+        }
+        std::replace(line.begin(), line.end(), ',', ' ');
+        std::istringstream fields(line);
+        double start, rate;
+        if (!(fields >> start >> rate) || rate < 0 || (!m_start.empty() && start <= m_start.back()))
+        {
+            std::cerr << "Error: Bad arrival schedule line in " << filename << ": " << line << std::endl;
+            return false;
+        }
+        m_start.push_back(start);
+        m_rate.push_back(rate);
+    }
+    if (m_start.empty())
+    {
+        std::cerr << "Error: Arrival schedule " << filename << " has no buckets" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
+double ArrivalRateSchedule::GetBucketEnd(uint32_t bucket, double endTime) const
+{
+    return (bucket + 1 < m_start.size()) ? m_start[bucket + 1] : std::max(endTime, m_start[bucket]);
+}
+
+
+uint32_t ArrivalRateSchedule::FindBucket(double time) const
+{
+    auto it = std::upper_bound(m_start.begin(), m_start.end(), time);
+    return (it == m_start.begin()) ? 0 : static_cast<uint32_t>(it - m_start.begin() - 1);
+}
+
+
+double ArrivalRateSchedule::ExpectedArrivals(double endTime) const
+{
+    double expected = 0;
+    for (uint32_t b = 0; b < m_start.size() && m_start[b] < endTime; b++)
+    {
+        expected += m_rate[b] * (std::min(GetBucketEnd(b, endTime), endTime) - m_start[b]);
+    }
+    return expected;
+}
+
+
+// Returns the time at which the integrated rate since currentTime reaches
+// work, advancing the caller's bucket cursor, or infinity if the rate stays
+// zero from here on.
+double ArrivalRateSchedule::NextArrival(double currentTime, double work, uint32_t& bucket) const
+{
+    double time = std::max(currentTime, m_start[0]);
+    while (true)
+    {
+        bool last = (bucket + 1 == m_start.size());
+        double rate = (time >= m_start[bucket]) ? m_rate[bucket] : 0;
+        if (last)
+        {
+            return (rate > 0) ? time + work / rate : std::numeric_limits<double>::infinity();
+        }
+       
+        double end = m_start[bucket + 1];
+        if (rate > 0 && work <= rate * (end - time))
+        {
+            return time + work / rate;
+        }
+        work -= rate * (end - time);
+        time = end;
+        bucket++;
+    }
+}
+
+
+// Number of open lanes over the day. Each line holds a time and the lane
+// count from then on, "3600,4"; the first count applies from the start of
+// the run whatever its time.
+class StaffingSchedule
+{
+public:
+    bool Load(const std::string& filename);
+    uint32_t GetStepCount() const { return m_time.size(); }
+    double GetStepTime(uint32_t step) const { return m_time[step]; }
+    uint32_t GetStepCashiers(uint32_t step) const { return m_cashiers[step]; }
+    uint32_t GetMaxCashiers() const { return *std::max_element(m_cashiers.begin(), m_cashiers.end()); }
+   
+private:
+    std::vector<double> m_time;
+    std::vector<uint32_t> m_cashiers;
+};
+
+
+bool StaffingSchedule::Load(const std::string& filename)
+{
+    std::ifstream in(filename);
+    if (!in.is_open())
+    {
+        std::cerr << "Error: Could not open staffing plan " << filename << std::endl;
+        return false;
+    }
+   
+    std::string line;
+    while (std::getline(in, line))
+    {
+        if (line.empty() || line[0] == '#')
+        {
+            continue;
+        }
+        std::replace(line.begin(), line.end(), ',', ' ');
+        std::istringstream fields(line);
+        double time;
+        int64_t cashiers;
+        if (!(fields >> time >> cashiers) || cashiers < 1 || (!m_time.empty() && time <= m_time.back()))
+        {
+            std::cerr << "Error: Bad staffing plan line in " << filename << ": " << line << std::endl;
+            return false;
+        }
+        m_time.push_back(time);
+        m_cashiers.push_back(static_cast<uint32_t>(cashiers));
+    }
+    if (m_time.empty())
+    {
+        std::cerr << "Error: Staffing plan " << filename << " has no steps" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
+struct BucketStats
+{
+    uint64_t arrivals;
+    WaitingTimeStats waits;
+};
+
+
+// Arrival times and service demands of one run, generated once and replayed
+// against every cashier count by the trace sweep.
+struct ArrivalTrace
+{
+    std::vector<double> arrivals;
+    std::vector<double> demands;
+};
+
+
+// Recorded arrivals replayed in place of the random streams. The file is the
+// magic "SMTRC001", a uint64 record count and then the records, each a
+// little-endian float64 arrival time and float64 service demand in seconds,
+// with arrival times non-decreasing. It is memory-mapped read-only and read
+// front to back, so the kernel pages it in ahead of the simulation and real
+// point-of-sale data needs no parsing.
+class MappedTrace
+{
+public:
+    static constexpr uint64_t PREFETCH_RECORDS = 65536;
+   
+    MappedTrace() : m_data(nullptr), m_size(0), m_modified(0), m_records(nullptr), m_count(0) {}
+    ~MappedTrace();
+    bool Open(const std::string& filename);
+    uint64_t GetCount() const { return m_count; }
+    uint64_t GetFileSize() const { return m_size; }
+    int64_t GetModified() const { return m_modified; }
+    double GetArrival(uint64_t index) const { return m_records[2 * index]; }
+    double GetDemand(uint64_t index) const { return m_records[2 * index + 1]; }
+    void Prefetch(uint64_t index) const;
+   
+private:
+    void* m_data;
+    size_t m_size;
+    int64_t m_modified;
+    const double* m_records;
+    uint64_t m_count;
+};
+
+
+MappedTrace::~MappedTrace()
+{
+    if (m_data != nullptr)
+    {
+        munmap(m_data, m_size);
+    }
+}
+
+
+bool MappedTrace::Open(const std::string& filename)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        std::cerr << "Error: Could not open replay trace " << filename << std::endl;
+        return false;
+    }
+   
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < 16)
+    {
+        std::cerr << "Error: Replay trace " << filename << " is too short" << std::endl;
+        close(fd);
+        return false;
+    }
+   
+    m_size = static_cast<size_t>(info.st_size);
+    m_modified = static_cast<int64_t>(info.st_mtime);
+    m_data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (m_data == MAP_FAILED)
+    {
+        m_data = nullptr;
+        std::cerr << "Error: Could not map replay trace " << filename << std::endl;
+        return false;
+    }
+    madvise(m_data, m_size, MADV_SEQUENTIAL);
+   
+    const char* bytes = static_cast<const char*>(m_data);
+    std::memcpy(&m_count, bytes + 8, sizeof(m_count));
+    if (std::memcmp(bytes, "SMTRC001", 8) != 0 || m_count > (m_size - 16) / 16)
+    {
+        std::cerr << "Error: " << filename << " is not a replay trace or is truncated" << std::endl;
+        return false;
+    }
+    m_records = reinterpret_cast<const double*>(bytes + 16);
+    return true;
+}
+
+
+// Called as each record is consumed; at the start of every window it asks
+// the kernel to read the next one in.
+void MappedTrace::Prefetch(uint64_t index) const
+{
+    if (index % PREFETCH_RECORDS != 0 || index >= m_count)
+    {
+        return;
+    }
+    const long page = sysconf(_SC_PAGESIZE);
+    uintptr_t begin = reinterpret_cast<uintptr_t>(m_records + 2 * index) & ~static_cast<uintptr_t>(page - 1);
+    uintptr_t end = reinterpret_cast<uintptr_t>(m_records + 2 * std::min(index + PREFETCH_RECORDS, m_count));
+    madvise(reinterpret_cast<void*>(begin), end - begin, MADV_WILLNEED);
+}
+
+
+bool WriteReplayTrace(const std::string& filename, const ArrivalTrace& trace)
+{
+    FILE* out = std::fopen(filename.c_str(), "wb");
+    if (out == nullptr)
+    {
+        std::cerr << "Error: Could not open " << filename << " for writing." << std::endl;
+        return false;
+    }
+   
+    uint64_t count = trace.arrivals.size();
+    std::fwrite("SMTRC001", 1, 8, out);
+    std::fwrite(&count, sizeof(count), 1, out);
+    for (size_t i = 0; i < trace.arrivals.size(); i++)
+    {
+        double record[2] = {trace.arrivals[i], trace.demands[i]};
+        std::fwrite(record, sizeof(record), 1, out);
+    }
+    return std::fclose(out) == 0;
+}
+
+
+class SupermarketSimulation
+{
+public:
+    SupermarketSimulation(uint32_t numCashiers, double arrivalRate, double serviceRate);
+    int64_t AssignStreams(int64_t stream);
+    void SetKeepRawSamples(bool keep) { m_keepRawSamples = keep; }
+    const std::vector<double>& GetWaitingTimes() const { return m_rawWaitingTimes; }
+    const std::vector<double>& GetArrivalTimes() const { return m_rawArrivalTimes; }
+    bool WriteWaitingTimes(const std::string& filename, bool columnar = false) const;
+    bool EnableCustomerTrace(const std::string& filename, bool columnar = false, uint32_t sampleEvery = 1,
+                             const std::string& compressor = "")
+    {
+        return m_customerTrace.Open(filename, columnar, sampleEvery, compressor);
+    }
+    bool SetCashierSelection(const std::string& policy);
+    void SetBatchMeans(uint32_t batches, uint32_t minBatches, double ciHalfWidth);
+    void SetWarmupTime(double warmupTime) { m_warmupTime = warmupTime; }
+    void SetServiceAtArrival(bool atArrival) { m_serviceAtArrival = atArrival; }
+    bool SetEngine(const std::string& engine);
+    bool SetRandomSource(const std::string& source);
+    void SetArrivalDistribution(std::shared_ptr<const DistributionSpec> spec);
+    void SetServiceDistribution(std::shared_ptr<const DistributionSpec> spec);
+    void SetArrivalSchedule(std::shared_ptr<const ArrivalRateSchedule> schedule);
+    void GenerateTrace(double simulationTime, ArrivalTrace& trace);
+    void SetReplayTrace(std::shared_ptr<const MappedTrace> trace) { m_replayTrace = trace; }
+    void PrintBucketReport(std::ostream& os, double targetWait) const;
+    void SetStaffing(std::shared_ptr<const StaffingSchedule> plan, uint32_t openAbove);
+    void ReplaceStaffingPlan(std::shared_ptr<const StaffingSchedule> plan);
+    void SetCustomerClasses(double priorityShare, uint32_t balkAbove, double meanPatience);
+    void PrintClassReport(std::ostream& os) const;
+    void SetBranchPoint(double time, std::function<void()> callback);
+    bool SetTopology(const std::string& topology, const std::string& routing);
+    void SetExpressLanes(uint32_t lanes, uint32_t maxItems, double meanItems);
+    void PrintLaneReport(std::ostream& os) const;
+    void PrintCashierBreakdown(std::ostream& os) const;
+    void PrintStaffingReport(std::ostream& os) const;
+    void RunSimulation(double simulationTime);
+    void HandleEvent(uint32_t slot);
+    void SetEventTiming(bool enabled) { m_timeEvents = enabled; }
+    void SetCheckpoint(const std::string& filename, double interval, bool resume, const std::string& key);
+    uint64_t GetEventCount() const { return m_events; }
+    const RunCounters& GetCounters() const { return m_counters; }
+    uint64_t GetArrivalCount() const { return m_customerId; }
+    double GetNanosecondsPerArrival() const { return m_arrivalEvents ? m_arrivalNs / m_arrivalEvents : 0; }
+    double GetNanosecondsPerCompletion() const { return m_completionEvents ? m_completionNs / m_completionEvents : 0; }
+    CashierResults GetResults() const;
+    void PrintResults(std::ostream& os = std::cout);
+   
+private:
+    void DispatchEvent(uint32_t slot);
+    bool SaveState(Snapshot& snapshot) const;
+    bool LoadState(Snapshot& snapshot);
+    bool ResumeFromCheckpoint();
+    void WriteCheckpoint();
+    void RecordQueueChange(double currentTime, int64_t delta);
+    template <bool CLASSED>
+    void CustomerArrival();
+    template <bool CLASSED>
+    void CustomerServiceEnd(uint32_t cashierId);
+    template <bool CLASSED>
+    void Enqueue(uint32_t customer, double currentTime);
+    template <bool CLASSED>
+    uint32_t Dequeue(double currentTime);
+    template <bool CLASSED>
+    uint64_t GetWaitingCount() const { return CLASSED ? m_waitingCustomers : m_queue.size(); }
+    void AssignClass(uint32_t customer);
+    void ExpireImpatient(double currentTime);
+    void ScheduleNextArrival();
+    void ScheduleServiceEnd(uint32_t cashierId, double serviceTime);
+    void StartService(uint32_t cashierId, uint32_t customer, double currentTime);
+    void CompleteService(uint32_t cashierId, double currentTime);
+    void StopSimulation();
+    void RecordWaitingTime(const Customer& customer, double currentTime);
+    void CloseBatch();
+    void EndWarmup();
+    void CreateVariateSources();
+    void ChangeStaffing();
+    void AdjustStaffing(double currentTime);
+    void OpenCashier(double currentTime);
+    void CloseCashier(double currentTime);
+    void RetireCashier(uint32_t cashierId, double currentTime);
+    void RecordStaffingChange(double currentTime);
+    uint32_t RouteCustomer(uint32_t customer);
+    uint32_t RandomLane(uint32_t numLanes);
+    LaneLengthIndex& LaneIndex(uint32_t lane);
+   
+    uint32_t m_numCashiers;
+    double m_arrivalRate;
+    double m_serviceRate;
+    double m_simulationTime;
+    uint32_t m_customerId;
+    uint32_t m_customersServed;
+   
+    CashierStore m_cashiers;
+    std::unique_ptr<IdleCashierPool> m_idleCashiers;
+    CustomerPool m_customers;
+    CustomerQueue m_queue;
+    CustomerTraceWriter m_customerTrace;
+   
+    WaitingTimeStats m_waitStats;
+    P2Quantiles m_waitPercentiles;
+    TimeWeightedStat m_queueLength;
+    TimeWeightedStat m_busyCashiers;
+    double m_endTime;
+    bool m_keepRawSamples;
+    std::vector<double> m_rawWaitingTimes;
+    std::vector<double> m_rawArrivalTimes;
+    double m_warmupTime;
+   
+    uint32_t m_batches;
+    uint32_t m_minBatches;
+    double m_ciHalfWidth;
+    double m_batchLength;
+    uint32_t m_currentBatch;
+    WaitingTimeStats m_batchStats;
+    WaitingTimeStats m_batchMeans;
+    bool m_stopRequested;
+    bool m_serviceAtArrival;
+   
+    Ptr<ExponentialRandomVariable> m_arrivalRandom;
+    Ptr<ExponentialRandomVariable> m_serviceRandom;
+    std::string m_randomSource;
+    std::shared_ptr<const DistributionSpec> m_arrivalDistribution;
+    std::shared_ptr<const DistributionSpec> m_serviceDistribution;
+    int64_t m_streamBase;
+    VariateBuffer m_arrivalVariates;
+    VariateBuffer m_serviceVariates;
+   
+    std::shared_ptr<const ArrivalRateSchedule> m_arrivalSchedule;
+    uint32_t m_scheduleBucket;
+    std::vector<BucketStats> m_bucketStats;
+    std::shared_ptr<const MappedTrace> m_replayTrace;
+    uint64_t m_replayNext;
+   
+    std::shared_ptr<const StaffingSchedule> m_staffingPlan;
+    uint32_t m_staffingStep;
+    uint32_t m_openAbove;
+    uint32_t m_targetOpen;
+    uint32_t m_openCashiers;
+    uint32_t m_pendingCloses;
+    std::vector<uint32_t> m_closedCashiers;
+    uint32_t m_laneOpenings;
+    uint32_t m_laneClosings;
+    uint32_t m_peakOpen;
+    double m_openLaneTime;
+    double m_lastStaffingChange;
+   
+    bool m_laneQueues;
+    LaneRouting m_routing;
+    std::vector<CustomerQueue> m_lanes;
+    LaneLengthIndex m_regularLanes;
+    LaneLengthIndex m_expressLaneIndex;
+    uint32_t m_expressLanes;
+    uint32_t m_activeExpressLanes;
+    uint32_t m_expressItems;
+    double m_meanItems;
+    uint32_t m_expressCustomers;
+    FastRng m_routingRng;
+   
+    std::unique_ptr<EventEngine> m_engine;
+    bool m_stopped;
+   
+    uint64_t m_events;
+    bool m_timeEvents;
+    uint64_t m_arrivalEvents;
+    uint64_t m_completionEvents;
+    double m_arrivalNs;
+    double m_completionNs;
+   
+    RunCounters m_counters;
+   
+    double m_branchTime;
+    std::function<void()> m_branchCallback;
+   
+    bool m_classed;
+    double m_priorityShare;
+    uint32_t m_balkAbove;
+    double m_meanPatience;
+    CustomerQueue m_priorityQueue;
+    std::vector<PatienceDeadline> m_patienceHeap;
+    uint64_t m_waitingCustomers;
+    FastRng m_classRng;
+    uint32_t m_balked;
+    uint32_t m_reneged;
+    WaitingTimeStats m_priorityWaits;
+    WaitingTimeStats m_regularWaits;
+   
+    std::string m_checkpointFile;
+    std::string m_checkpointKey;
+    double m_checkpointInterval;
+    bool m_resume;
+    std::chrono::steady_clock::time_point m_lastCheckpoint;
+    std::thread m_checkpointWriter;
+};
+
+
+SupermarketSimulation::SupermarketSimulation(uint32_t numCashiers, double arrivalRate, double serviceRate)
+    : m_numCashiers(numCashiers), m_arrivalRate(arrivalRate), m_serviceRate(serviceRate),
+      m_simulationTime(0), m_customerId(0), m_customersServed(0), m_cashiers(numCashiers),
+      m_waitPercentiles(0.50, 0.95, 0.99), m_endTime(0), m_keepRawSamples(false), m_warmupTime(0),
+      m_batches(0), m_minBatches(0), m_ciHalfWidth(0), m_batchLength(0), m_currentBatch(0),
+      m_stopRequested(false), m_serviceAtArrival(false), m_randomSource("ns3"),
+      m_streamBase(-1),
+      m_scheduleBucket(0), m_replayNext(0), m_staffingStep(0), m_openAbove(0), m_targetOpen(numCashiers),
+      m_openCashiers(numCashiers), m_pendingCloses(0), m_laneOpenings(0), m_laneClosings(0),
+      m_peakOpen(numCashiers), m_openLaneTime(0), m_lastStaffingChange(0), m_laneQueues(false),
+      m_routing(JSQ_ROUTING), m_expressLanes(0), m_activeExpressLanes(0), m_expressItems(0), m_meanItems(0), m_expressCustomers(0),
+      m_stopped(false), m_events(0), m_timeEvents(false), m_arrivalEvents(0), m_completionEvents(0),
+      m_arrivalNs(0), m_completionNs(0), m_counters(),
+      m_branchTime(0), m_classed(false), m_priorityShare(0), m_balkAbove(0), m_meanPatience(0),
+      m_waitingCustomers(0), m_balked(0), m_reneged(0), m_checkpointInterval(0), m_resume(false)
+{
+    SetCashierSelection("lowest");
+   
+    m_arrivalRandom = CreateObject<ExponentialRandomVariable>();
+    m_arrivalRandom->SetAttribute("Mean", DoubleValue(1.0 / m_arrivalRate));
+   
+    m_serviceRandom = CreateObject<ExponentialRandomVariable>();
+    m_serviceRandom->SetAttribute("Mean", DoubleValue(1.0 / m_serviceRate));
+    CreateVariateSources();
+   
+    SetEngine("ns3");
+}
+
+
+// "ns3" buffers the ns-3 ExponentialRandomVariable streams and yields the
+// same numbers as drawing from them directly; "fast" fills blocks from
+// FastRng with the vectorized exponential kernel.
+bool SupermarketSimulation::SetRandomSource(const std::string& source)
+{
+    if (source != "ns3" && source != "fast")
+    {
+        NS_LOG_ERROR("Unknown random source '" << source << "'");
+        return false;
+    }
+   
+    m_randomSource = source;
+    CreateVariateSources();
+    return true;
+}
+
+
+// With a schedule, interarrival draws (mean 1/arrivalRate) are rescaled to
+// unit mean and spent against the integrated rate, so the configured
+// arrival distribution shapes the process in operational time.
+void SupermarketSimulation::SetArrivalSchedule(std::shared_ptr<const ArrivalRateSchedule> schedule)
+{
+    m_arrivalSchedule = schedule;
+    m_scheduleBucket = 0;
+    m_bucketStats.assign(schedule ? schedule->GetBucketCount() : 0, BucketStats());
+}
+
+
+void SupermarketSimulation::PrintBucketReport(std::ostream& os, double targetWait) const
+{
+    if (!m_arrivalSchedule)
+    {
+        return;
+    }
+   
+    os << "Per-bucket results (" << m_numCashiers << " cashiers)" << std::endl;
+    os << "  Start(s) |   Rate | Arrivals | Served | Avg Wait | Erlang-C Cashiers" << std::endl;
+    for (uint32_t b = 0; b < m_bucketStats.size(); b++)
+    {
+        if (m_arrivalSchedule->GetBucketStart(b) >= m_simulationTime)
+        {
+            break;
+        }
+        const BucketStats& bucket = m_bucketStats[b];
+        double rate = m_arrivalSchedule->GetBucketRate(b);
+        os << std::setw(10) << std::fixed << std::setprecision(0) << m_arrivalSchedule->GetBucketStart(b) << " | "
+           << std::setw(6) << std::fixed << std::setprecision(2) << rate << " | "
+           << std::setw(8) << bucket.arrivals << " | "
+           << std::setw(6) << bucket.waits.GetCount() << " | "
+           << std::setw(8) << std::fixed << std::setprecision(2) << bucket.waits.GetMean() << " | "
+           << std::setw(17) << RequiredCashiers(rate, m_serviceRate, targetWait) << std::endl;
+    }
+}
+
+
+// Interarrival and service times default to exponential with the configured
+// means (also for a null spec); any other distribution is sampled by a
+// DistributionSource on the same stream indices, whatever the random source.
+void SupermarketSimulation::SetArrivalDistribution(std::shared_ptr<const DistributionSpec> spec)
+{
+    m_arrivalDistribution = spec;
+    CreateVariateSources();
+}
+
+
+void SupermarketSimulation::SetServiceDistribution(std::shared_ptr<const DistributionSpec> spec)
+{
+    m_serviceDistribution = spec;
+    CreateVariateSources();
+}
+
+
+void SupermarketSimulation::CreateVariateSources()
+{
+    int64_t stream = (m_streamBase >= 0) ? m_streamBase : 0;
+   
+    if (m_arrivalDistribution && m_arrivalDistribution->name != "exponential")
+    {
+        m_arrivalVariates.SetSource(CreateDistributionSource(*m_arrivalDistribution, 1.0 / m_arrivalRate, stream));
+    }
+    else if (m_randomSource == "fast")
+    {
+        m_arrivalVariates.SetSource(std::unique_ptr<VariateSource>(
+            new FastExponentialSource(1.0 / m_arrivalRate, stream)));
+    }
+    else
+    {
+        m_arrivalVariates.SetSource(std::unique_ptr<VariateSource>(new Ns3VariateSource(m_arrivalRandom)));
+    }
+   
+    if (m_serviceDistribution && m_serviceDistribution->name != "exponential")
+    {
+        m_serviceVariates.SetSource(CreateDistributionSource(*m_serviceDistribution, 1.0 / m_serviceRate, stream + 1));
+    }
+    else if (m_randomSource == "fast")
+    {
+        m_serviceVariates.SetSource(std::unique_ptr<VariateSource>(
+            new FastExponentialSource(1.0 / m_serviceRate, stream + 1)));
+    }
+    else
+    {
+        m_serviceVariates.SetSource(std::unique_ptr<VariateSource>(new Ns3VariateSource(m_serviceRandom)));
+    }
+}
+
+
+bool SupermarketSimulation::SetEngine(const std::string& engine)
+{
+    std::unique_ptr<EventEngine> created = CreateEventEngine(engine);
+    if (created == nullptr)
+    {
+        NS_LOG_ERROR("Unknown event engine '" << engine << "'");
+        return false;
+    }
+   
+    m_engine = std::move(created);
+    return true;
+}
+
+
+bool SupermarketSimulation::SetCashierSelection(const std::string& policy)
+{
+    std::unique_ptr<IdleCashierPool> pool = CreateIdleCashierPool(policy);
+    if (pool == nullptr)
+    {
+        NS_LOG_ERROR("Unknown cashier selection policy '" << policy << "'");
+        return false;
+    }
+   
+    pool->Reset(m_numCashiers, m_numCashiers);
+    m_idleCashiers = std::move(pool);
+    return true;
+}
+
+
+// Splits the run into equal batches of simulated time; the batch means give
+// a confidence interval from a single run. With ciHalfWidth > 0 the run ends
+// early once at least minBatches are complete and the interval is tight enough.
+void SupermarketSimulation::SetBatchMeans(uint32_t batches, uint32_t minBatches, double ciHalfWidth)
+{
+    m_batches = batches;
+    m_minBatches = std::max<uint32_t>(minBatches, 2);
+    m_ciHalfWidth = ciHalfWidth;
+}
+
+
+int64_t SupermarketSimulation::AssignStreams(int64_t stream)
+{
+    m_arrivalRandom->SetStream(stream);
+    m_serviceRandom->SetStream(stream + 1);
+    m_streamBase = stream;
+    CreateVariateSources();
+    if (m_classed)
+    {
+        m_classRng.Seed(RngSeedManager::GetSeed(), RngSeedManager::GetRun(),
+                        CLASS_STREAM + std::max<int64_t>(m_streamBase, 0));
+    }
+    return 2;
+}
+
+
+void SupermarketSimulation::RunSimulation(double simulationTime)
+{
+    NS_LOG_INFO("Starting simulation with " << m_numCashiers << " cashiers");
+    NS_LOG_INFO("Arrival rate: " << m_arrivalRate << " customers/second");
+    NS_LOG_INFO("Service rate: " << m_serviceRate << " customers/second");
+    NS_LOG_INFO("Simulation time: " << simulationTime << " seconds");
+   
+    m_simulationTime = simulationTime;
+    m_stopped = false;
+    m_stopRequested = false;
+    m_batchLength = (m_batches > 0) ? (simulationTime - m_warmupTime) / m_batches : 0;
+    m_engine->Reset(this, m_numCashiers + NUM_CONTROL_EVENTS);
+   
+    if (m_replayTrace)
+    {
+        m_serviceAtArrival = true;
+        m_replayNext = 0;
+    }
+   
+    if (m_classed)
+    {
+        m_classRng.Seed(RngSeedManager::GetSeed(), RngSeedManager::GetRun(),
+                        CLASS_STREAM + std::max<int64_t>(m_streamBase, 0));
+    }
+   
+    bool resumed = ResumeFromCheckpoint();
+    if (!resumed && (m_staffingPlan || m_openAbove > 0))
+    {
+        m_targetOpen = std::min(m_numCashiers, m_staffingPlan ? m_staffingPlan->GetStepCashiers(0) : 1);
+        m_openCashiers = m_targetOpen;
+        m_peakOpen = m_targetOpen;
+        m_closedCashiers.clear();
+        for (uint32_t i = m_numCashiers; i > m_targetOpen; i--)
+        {
+            m_cashiers[i - 1].Close(0);
+            m_closedCashiers.push_back(i - 1);
+        }
+        m_idleCashiers->Reset(m_numCashiers, m_targetOpen);
+        m_staffingStep = 1;
+        if (m_staffingPlan && m_staffingPlan->GetStepCount() > 1)
+        {
+            m_engine->Schedule(m_numCashiers + STAFFING_EVENT, m_staffingPlan->GetStepTime(1));
+        }
+    }
+   
+    if (m_laneQueues)
+    {
+        m_activeExpressLanes = std::min(m_expressLanes, m_numCashiers - 1);
+        m_lanes.assign(m_numCashiers, CustomerQueue());
+        m_regularLanes.Reset(0, m_numCashiers - m_activeExpressLanes);
+        m_expressLaneIndex.Reset(m_numCashiers - m_activeExpressLanes, m_activeExpressLanes);
+        m_routingRng.Seed(RngSeedManager::GetSeed(), RngSeedManager::GetRun(),
+                          ROUTING_STREAM + std::max<int64_t>(m_streamBase, 0));
+        if (m_activeExpressLanes > 0)
+        {
+            m_serviceAtArrival = true;
+        }
+    }
+   
+    if (!resumed)
+    {
+        ScheduleNextArrival();
+        if (m_warmupTime > 0)
+        {
+            m_engine->Schedule(m_numCashiers + WARMUP_EVENT, m_warmupTime);
+        }
+        m_engine->Schedule(m_numCashiers + STOP_EVENT, simulationTime);
+        if (m_branchCallback && m_branchTime < simulationTime)
+        {
+            m_engine->Schedule(m_numCashiers + BRANCH_EVENT, m_branchTime);
+        }
+    }
+    m_lastCheckpoint = std::chrono::steady_clock::now();
+   
+    auto runStart = InstrumentationNow();
+    m_engine->Run();
+    auto drainStart = InstrumentationNow();
+   
+    double currentTime = m_engine->Now();
+    if (m_classed)
+    {
+        ExpireImpatient(currentTime);
+    }
+    m_cashiers.ForEachBusy([this, currentTime](uint32_t cashierId) { CompleteService(cashierId, currentTime); });
+    m_cashiers.FinalizeIdleTime(currentTime);
+    RecordStaffingChange(currentTime);
+    if (m_batches > 0)
+    {
+        CloseBatch();
+    }
+    m_customerTrace.Close();
+    if (m_checkpointWriter.joinable())
+    {
+        m_checkpointWriter.join();
+    }
+    if (!m_checkpointFile.empty())
+    {
+        std::remove(m_checkpointFile.c_str());
+    }
+   
+    if (INSTRUMENTATION_ENABLED)
+    {
+        m_counters.maxQueueLength = static_cast<uint64_t>(m_queueLength.GetMax());
+        m_counters.queueArea = m_queueLength.GetArea(currentTime);
+        m_counters.queueSpan = currentTime - m_queueLength.GetStart();
+        m_counters.schedules = m_engine->GetScheduleCount();
+        m_counters.cancels = m_engine->GetCancelCount();
+        m_counters.variateDraws = m_arrivalVariates.GetDrawCount() + m_serviceVariates.GetDrawCount();
+        m_counters.simulatedTime = currentTime;
+        m_counters.runSeconds = std::chrono::duration<double>(drainStart - runStart).count();
+        m_counters.drainSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - drainStart).count();
+    }
+    m_endTime = currentTime;
+    g_events.fetch_add(m_events, std::memory_order_relaxed);
+}
+
+
+// Customers waiting in the pooled queue or any lane queue, integrated over
+// simulated time.
+void SupermarketSimulation::RecordQueueChange(double currentTime, int64_t delta)
+{
+    m_queueLength.Add(currentTime, delta);
+}
+
+
+// With event timing on, each arrival and service completion is timed
+// individually for the benchmark; otherwise events are only counted.
+void SupermarketSimulation::HandleEvent(uint32_t slot)
+{
+    m_events++;
+    if (INSTRUMENTATION_ENABLED)
+    {
+        if (slot < m_numCashiers)
+        {
+            m_counters.serviceEndEvents++;
+        }
+        else if (slot == m_numCashiers + ARRIVAL_EVENT)
+        {
+            m_counters.arrivalEvents++;
+            m_counters.queueLengthAtArrivals += m_queueLength.GetValue();
+        }
+        else
+        {
+            m_counters.controlEvents++;
+        }
+    }
+    if (!m_timeEvents)
+    {
+        DispatchEvent(slot);
+    }
+    else
+    {
+        auto start = std::chrono::steady_clock::now();
+        DispatchEvent(slot);
+        double elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        if (slot < m_numCashiers)
+        {
+            m_completionEvents++;
+            m_completionNs += elapsed;
+        }
+        else if (slot == m_numCashiers + ARRIVAL_EVENT)
+        {
+            m_arrivalEvents++;
+            m_arrivalNs += elapsed;
+        }
+    }
+   
+    // Between events the model is consistent; the clock is read only every
+    // CHECKPOINT_CHECK_EVENTS events so the check costs nothing measurable.
+    if (m_checkpointInterval > 0 && m_events % CHECKPOINT_CHECK_EVENTS == 0 && !m_stopped &&
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - m_lastCheckpoint).count() >= m_checkpointInterval)
+    {
+        WriteCheckpoint();
+    }
+}
+
+
+// With resume set, RunSimulation continues from filename if it holds a
+// checkpoint taken under the same key (the options that shape the run), and
+// otherwise starts afresh. While the run goes on it saves its state to
+// filename every interval wall-clock seconds, and removes the file once the
+// run completes. Checkpoints need the calendar engine and the pooled queue
+// without customer classes, whose state they do not hold.
+void SupermarketSimulation::SetCheckpoint(const std::string& filename, double interval, bool resume,
+                                          const std::string& key)
+{
+    if (m_classed || m_laneQueues)
+    {
+        NS_FATAL_ERROR("Checkpoints do not hold customer classes or lane queues");
+    }
+    m_checkpointFile = filename;
+    m_checkpointInterval = interval;
+    m_resume = resume;
+    m_checkpointKey = key;
+}
+
+
+// The model is serialized on the simulation thread, which takes time in
+// proportion to the customers in the system; the file is written by a
+// background thread while the run continues.
+void SupermarketSimulation::WriteCheckpoint()
+{
+    Snapshot snapshot;
+    if (!SaveState(snapshot))
+    {
+        NS_LOG_ERROR("The " << m_checkpointFile << " checkpoint cannot be taken on this engine, not saving");
+        m_checkpointInterval = 0;
+        return;
+    }
+    m_lastCheckpoint = std::chrono::steady_clock::now();
+    if (m_checkpointWriter.joinable())
+    {
+        m_checkpointWriter.join();
+    }
+    std::string filename = m_checkpointFile;
+    m_checkpointWriter = std::thread([filename](Snapshot&& taken) { taken.WriteFile(filename); },
+                                     std::move(snapshot));
+}
+
+
+bool SupermarketSimulation::ResumeFromCheckpoint()
+{
+    if (!m_resume || m_checkpointFile.empty())
+    {
+        return false;
+    }
+   
+    Snapshot snapshot;
+    if (!snapshot.ReadFile(m_checkpointFile))
+    {
+        NS_LOG_INFO("No checkpoint in " << m_checkpointFile << ", starting from the beginning");
+        return false;
+    }
+    std::string key;
+    snapshot.GetString(key);
+    if (key != m_checkpointKey)
+    {
+        NS_LOG_ERROR("Checkpoint " << m_checkpointFile << " is from a different run, starting from the beginning");
+        return false;
+    }
+    // Past the key the model is overwritten piece by piece, so a bad file
+    // cannot fall back to a fresh start.
+    if (!LoadState(snapshot))
+    {
+        NS_FATAL_ERROR("Checkpoint " << m_checkpointFile << " is corrupt");
+    }
+    NS_LOG_INFO("Resumed from " << m_checkpointFile << " at " << m_engine->Now() << " seconds");
+    return true;
+}
+
+
+bool SupermarketSimulation::SaveState(Snapshot& snapshot) const
+{
+    snapshot.PutString(m_checkpointKey);
+    if (!m_engine->Save(snapshot))
+    {
+        return false;
+    }
+    snapshot.Put(m_customerId);
+    snapshot.Put(m_customersServed);
+    m_cashiers.Save(snapshot);
+    m_idleCashiers->Save(snapshot);
+    m_customers.Save(snapshot);
+    m_queue.Save(snapshot);
+   
+    snapshot.Put(m_waitStats);
+    snapshot.Put(m_waitPercentiles);
+    snapshot.Put(m_queueLength);
+    snapshot.Put(m_busyCashiers);
+    snapshot.PutVector(m_rawWaitingTimes);
+    snapshot.PutVector(m_rawArrivalTimes);
+    snapshot.Put(m_currentBatch);
+    snapshot.Put(m_batchStats);
+    snapshot.Put(m_batchMeans);
+    snapshot.Put(m_stopRequested);
+   
+    m_arrivalVariates.Save(snapshot);
+    m_serviceVariates.Save(snapshot);
+    snapshot.Put(m_scheduleBucket);
+    snapshot.PutVector(m_bucketStats);
+    snapshot.Put(m_replayNext);
+   
+    snapshot.Put(m_staffingStep);
+    snapshot.Put(m_targetOpen);
+    snapshot.Put(m_openCashiers);
+    snapshot.Put(m_pendingCloses);
+    snapshot.PutVector(m_closedCashiers);
+    snapshot.Put(m_laneOpenings);
+    snapshot.Put(m_laneClosings);
+    snapshot.Put(m_peakOpen);
+    snapshot.Put(m_openLaneTime);
+    snapshot.Put(m_lastStaffingChange);
+   
+    snapshot.Put(m_events);
+    snapshot.Put(m_counters);
+    return true;
+}
+
+
+// Expects the snapshot positioned just past the key SaveState wrote first.
+bool SupermarketSimulation::LoadState(Snapshot& snapshot)
+{
+    if (!m_engine->Load(snapshot))
+    {
+        return false;
+    }
+    snapshot.Get(m_customerId);
+    snapshot.Get(m_customersServed);
+    m_cashiers.Load(snapshot);
+    m_idleCashiers->Load(snapshot);
+    m_customers.Load(snapshot);
+    m_queue.Load(snapshot);
+   
+    snapshot.Get(m_waitStats);
+    snapshot.Get(m_waitPercentiles);
+    snapshot.Get(m_queueLength);
+    snapshot.Get(m_busyCashiers);
+    snapshot.GetVector(m_rawWaitingTimes);
+    snapshot.GetVector(m_rawArrivalTimes);
+    snapshot.Get(m_currentBatch);
+    snapshot.Get(m_batchStats);
+    snapshot.Get(m_batchMeans);
+    snapshot.Get(m_stopRequested);
+   
+    m_arrivalVariates.Load(snapshot);
+    m_serviceVariates.Load(snapshot);
+    snapshot.Get(m_scheduleBucket);
+    snapshot.GetVector(m_bucketStats);
+    snapshot.Get(m_replayNext);
+   
+    snapshot.Get(m_staffingStep);
+    snapshot.Get(m_targetOpen);
+    snapshot.Get(m_openCashiers);
+    snapshot.Get(m_pendingCloses);
+    snapshot.GetVector(m_closedCashiers);
+    snapshot.Get(m_laneOpenings);
+    snapshot.Get(m_laneClosings);
+    snapshot.Get(m_peakOpen);
+    snapshot.Get(m_openLaneTime);
+    snapshot.Get(m_lastStaffingChange);
+   
+    snapshot.Get(m_events);
+    snapshot.Get(m_counters);
+    return snapshot.IsValid();
+}
+
+
+void SupermarketSimulation::DispatchEvent(uint32_t slot)
+{
+    if (slot < m_numCashiers)
+    {
+        if (m_classed)
+        {
+            CustomerServiceEnd<true>(slot);
+        }
+        else
+        {
+            CustomerServiceEnd<false>(slot);
+        }
+        return;
+    }
+   
+    switch (slot - m_numCashiers)
+    {
+    case ARRIVAL_EVENT:
+        if (m_classed)
+        {
+            CustomerArrival<true>();
+        }
+        else
+        {
+            CustomerArrival<false>();
+        }
+        break;
+    case WARMUP_EVENT:
+        EndWarmup();
+        break;
+    case STOP_EVENT:
+        StopSimulation();
+        break;
+    case STAFFING_EVENT:
+        ChangeStaffing();
+        break;
+    case BRANCH_EVENT:
+        m_branchCallback();
+        break;
+    }
+}
+
+
+void SupermarketSimulation::StopSimulation()
+{
+    m_stopped = true;
+    m_engine->Stop();
+}
+
+
+// CLASSED selects at compile time between the plain FIFO and the queue with
+// priority, balking and reneging, so runs without customer classes execute
+// exactly the FIFO code.
+template <bool CLASSED>
+void SupermarketSimulation::CustomerArrival()
+{
+    if (m_stopped)
+    {
+        return;
+    }
+   
+    double currentTime = m_engine->Now();
+    if (CLASSED)
+    {
+        ExpireImpatient(currentTime);
+    }
+   
+    uint32_t customer = m_customers.Allocate(m_customerId++, currentTime);
+    if (CLASSED)
+    {
+        AssignClass(customer);
+    }
+    if (m_arrivalSchedule)
+    {
+        m_bucketStats[m_scheduleBucket].arrivals++;
+    }
+    if (m_replayTrace)
+    {
+        m_customers[customer].serviceDemand = m_replayTrace->GetDemand(m_replayNext++);
+        m_replayTrace->Prefetch(m_replayNext);
+    }
+    else if (m_serviceAtArrival)
+    {
+        m_customers[customer].serviceDemand = m_serviceVariates.Next();
+    }
+   
+    if (m_laneQueues)
+    {
+        uint32_t lane = RouteCustomer(customer);
+        LaneIndex(lane).Increment(lane);
+        if (m_cashiers[lane].IsBusy())
+        {
+            m_lanes[lane].push(customer);
+            RecordQueueChange(currentTime, 1);
+        }
+        else
+        {
+            StartService(lane, customer, currentTime);
+        }
+    }
+    else if (!m_idleCashiers->Empty())
+    {
+        StartService(m_idleCashiers->Acquire(), customer, currentTime);
+    }
+    else if (CLASSED && m_balkAbove > 0 && m_waitingCustomers >= m_balkAbove)
+    {
+        // Counted by arrival time, as reneging and service are, so every
+        // count covers the same customers.
+        if (m_customers[customer].arrivalTime >= m_warmupTime)
+        {
+            m_balked++;
+        }
+        m_customers.Release(customer);
+    }
+    else
+    {
+        Enqueue<CLASSED>(customer, currentTime);
+        if (m_openAbove > 0 && GetWaitingCount<CLASSED>() > m_openAbove &&
+            m_openCashiers - m_pendingCloses < m_numCashiers)
+        {
+            OpenCashier(currentTime);
+        }
+    }
+   
+    if (!m_stopped)
+    {
+        ScheduleNextArrival();
+    }
+}
+
+
+template <bool CLASSED>
+void SupermarketSimulation::CustomerServiceEnd(uint32_t cashierId)
+{
+    if (m_stopped)
+    {
+        return;
+    }
+   
+    double currentTime = m_engine->Now();
+    if (CLASSED)
+    {
+        ExpireImpatient(currentTime);
+    }
+    CompleteService(cashierId, currentTime);
+   
+    if (m_laneQueues)
+    {
+        LaneIndex(cashierId).Decrement(cashierId);
+        CustomerQueue& lane = m_lanes[cashierId];
+        if (!lane.empty())
+        {
+            uint32_t nextCustomer = lane.front();
+            lane.pop();
+            RecordQueueChange(currentTime, -1);
+            StartService(cashierId, nextCustomer, currentTime);
+        }
+        return;
+    }
+   
+    if (m_pendingCloses > 0)
+    {
+        m_pendingCloses--;
+        RetireCashier(cashierId, currentTime);
+        return;
+    }
+    if (GetWaitingCount<CLASSED>() == 0 && m_openAbove > 0 && m_openCashiers > m_targetOpen)
+    {
+        RetireCashier(cashierId, currentTime);
+        return;
+    }
+   
+    uint32_t nextCustomer = Dequeue<CLASSED>(currentTime);
+    if (nextCustomer != NO_CUSTOMER)
+    {
+        StartService(cashierId, nextCustomer, currentTime);
+    }
+    else
+    {
+        m_idleCashiers->Release(cashierId);
+    }
+}
+
+
+template <bool CLASSED>
+void SupermarketSimulation::Enqueue(uint32_t customer, double currentTime)
+{
+    if (CLASSED)
+    {
+        Customer& record = m_customers[customer];
+        record.waiting = true;
+        (record.priority ? m_priorityQueue : m_queue).push(customer);
+        m_waitingCustomers++;
+        if (m_meanPatience > 0)
+        {
+            double patience = -m_meanPatience * std::log(m_classRng.NextUniform());
+            m_patienceHeap.push_back({currentTime + patience, customer, record.id});
+            std::push_heap(m_patienceHeap.begin(), m_patienceHeap.end(), std::greater<PatienceDeadline>());
+        }
+    }
+    else
+    {
+        m_queue.push(customer);
+    }
+    RecordQueueChange(currentTime, 1);
+}
+
+
+// Returns NO_CUSTOMER if nobody is waiting. Loyalty customers go first;
+// customers who reneged are still in their queue and are dropped here.
+template <bool CLASSED>
+uint32_t SupermarketSimulation::Dequeue(double currentTime)
+{
+    if (!CLASSED)
+    {
+        if (m_queue.empty())
+        {
+            return NO_CUSTOMER;
+        }
+        uint32_t customer = m_queue.front();
+        m_queue.pop();
+        RecordQueueChange(currentTime, -1);
+        return customer;
+    }
+   
+    ExpireImpatient(currentTime);
+    for (CustomerQueue* queue : {&m_priorityQueue, &m_queue})
+    {
+        while (!queue->empty())
+        {
+            uint32_t customer = queue->front();
+            queue->pop();
+            if (m_customers[customer].reneged)
+            {
+                m_customers.Release(customer);
+                continue;
+            }
+            m_customers[customer].waiting = false;
+            m_waitingCustomers--;
+            RecordQueueChange(currentTime, -1);
+            return customer;
+        }
+    }
+    return NO_CUSTOMER;
+}
+
+
+// Customers whose patience ran out since the last event leave the queue
+// counts at their own deadline; their queue entries go when they reach the
+// front. No event is scheduled per waiting customer.
+void SupermarketSimulation::ExpireImpatient(double currentTime)
+{
+    while (!m_patienceHeap.empty() && m_patienceHeap.front().time <= currentTime)
+    {
+        PatienceDeadline deadline = m_patienceHeap.front();
+        std::pop_heap(m_patienceHeap.begin(), m_patienceHeap.end(), std::greater<PatienceDeadline>());
+        m_patienceHeap.pop_back();
+       
+        Customer& record = m_customers[deadline.customer];
+        if (record.id != deadline.id || !record.waiting)
+        {
+            continue;
+        }
+        record.waiting = false;
+        record.reneged = true;
+        m_waitingCustomers--;
+        RecordQueueChange(deadline.time, -1);
+        if (record.arrivalTime >= m_warmupTime)
+        {
+            m_reneged++;
+        }
+    }
+}
+
+
+void SupermarketSimulation::AssignClass(uint32_t customer)
+{
+    m_customers[customer].priority = (m_priorityShare > 0 && m_classRng.NextUniform() <= m_priorityShare);
+}
+
+
+// priorityShare of customers carry a loyalty card and are served before
+// everyone else; with balkAbove > 0 an arrival leaves at once if that many
+// are already waiting; with meanPatience > 0 each waiting customer gives up
+// after an exponential patience with that mean.
+void SupermarketSimulation::SetCustomerClasses(double priorityShare, uint32_t balkAbove, double meanPatience)
+{
+    m_priorityShare = priorityShare;
+    m_balkAbove = balkAbove;
+    m_meanPatience = meanPatience;
+    m_classed = (priorityShare > 0 || balkAbove > 0 || meanPatience > 0);
+    if (m_classed && !m_checkpointFile.empty())
+    {
+        NS_FATAL_ERROR("Checkpoints do not hold customer classes or lane queues");
+    }
+}
+
+
+void SupermarketSimulation::PrintClassReport(std::ostream& os) const
+{
+    if (!m_classed)
+    {
+        return;
+    }
+    os << "Customer classes: " << m_priorityWaits.GetCount() << " loyalty customers waited " << std::fixed
+       << std::setprecision(2) << m_priorityWaits.GetMean() << " seconds on average, "
+       << m_regularWaits.GetCount() << " others " << m_regularWaits.GetMean() << " seconds; "
+       << m_balked << " balked, " << m_reneged << " reneged" << std::endl;
+}
+
+
+void SupermarketSimulation::StartService(uint32_t cashierId, uint32_t customer, double currentTime)
+{
+    m_cashiers[cashierId].StartService(customer, currentTime);
+    m_busyCashiers.Add(currentTime, 1);
+    m_customers[customer].serviceStartTime = currentTime;
+    double serviceTime = m_serviceAtArrival ? m_customers[customer].serviceDemand : m_serviceVariates.Next();
+    ScheduleServiceEnd(cashierId, serviceTime);
+}
+
+
+void SupermarketSimulation::CompleteService(uint32_t cashierId, double currentTime)
+{
+    uint32_t customer = m_cashiers[cashierId].EndService(currentTime);
+    m_busyCashiers.Add(currentTime, -1);
+   
+    if (customer == NO_CUSTOMER)
+    {
+        NS_LOG_ERROR("CompleteService: Got no customer from cashier " << cashierId);
+        return;
+    }
+   
+    Customer& record = m_customers[customer];
+    record.serviceEndTime = currentTime;
+    if (m_customerTrace.IsOpen())
+    {
+        m_customerTrace.Write(record);
+    }
+   
+    if (record.arrivalTime >= m_warmupTime)
+    {
+        m_customersServed++;
+        RecordWaitingTime(record, currentTime);
+    }
+    m_customers.Release(customer);
+}
+
+
+// Only customers arriving after the warm-up period reach the statistics;
+// utilization is reset at the same instant by EndWarmup.
+void SupermarketSimulation::RecordWaitingTime(const Customer& customer, double currentTime)
+{
+    double waitingTime = customer.GetWaitingTime();
+    m_waitStats.Add(waitingTime);
+    m_waitPercentiles.Add(waitingTime);
+    if (m_classed)
+    {
+        (customer.priority ? m_priorityWaits : m_regularWaits).Add(waitingTime);
+    }
+    if (m_arrivalSchedule)
+    {
+        m_bucketStats[m_arrivalSchedule->FindBucket(customer.arrivalTime)].waits.Add(waitingTime);
+    }
+    if (m_keepRawSamples)
+    {
+        m_rawWaitingTimes.push_back(waitingTime);
+        m_rawArrivalTimes.push_back(customer.arrivalTime);
+    }
+   
+    if (m_batches > 0)
+    {
+        double elapsed = currentTime - m_warmupTime;
+        uint32_t batch = std::min<uint32_t>(static_cast<uint32_t>(elapsed / m_batchLength), m_batches - 1);
+        if (batch != m_currentBatch)
+        {
+            CloseBatch();
+            m_currentBatch = batch;
+            if (m_ciHalfWidth > 0 && !m_stopRequested && m_batchMeans.GetCount() >= m_minBatches &&
+                ConfidenceHalfWidth95(m_batchMeans) <= m_ciHalfWidth)
+            {
+                m_stopRequested = true;
+                m_engine->Schedule(m_numCashiers + STOP_EVENT, 0);
+            }
+        }
+        m_batchStats.Add(waitingTime);
+    }
+}
+
+
+void SupermarketSimulation::EndWarmup()
+{
+    double currentTime = m_engine->Now();
+    if (m_classed)
+    {
+        ExpireImpatient(currentTime);
+    }
+    m_cashiers.ResetStatistics(currentTime);
+    m_queueLength.Reset(currentTime);
+    m_busyCashiers.Reset(currentTime);
+}
+
+
+void SupermarketSimulation::CloseBatch()
+{
+    if (m_batchStats.GetCount() > 0)
+    {
+        m_batchMeans.Add(m_batchStats.GetMean());
+    }
+    m_batchStats = WaitingTimeStats();
+}
+
+
+bool SupermarketSimulation::WriteWaitingTimes(const std::string& filename, bool columnar) const
+{
+    if (columnar)
+    {
+        ColumnarWriter writer;
+        if (!writer.Open(filename, {{"arrival", ColumnarWriter::FLOAT64_COLUMN},
+                                    {"waiting", ColumnarWriter::FLOAT64_COLUMN}}))
+        {
+            return false;
+        }
+        for (size_t i = 0; i < m_rawWaitingTimes.size(); i++)
+        {
+            writer.Set(0, m_rawArrivalTimes[i]);
+            writer.Set(1, m_rawWaitingTimes[i]);
+            writer.EndRow();
+        }
+        return true;
+    }
+   
+    std::ofstream out(filename);
+    if (!out.is_open())
+    {
+        std::cerr << "Error: Could not open waiting time file " << filename << " for writing." << std::endl;
+        return false;
+    }
+   
+    out << "# Arrival(s) WaitingTime(s)\n";
+    out << std::fixed << std::setprecision(9);
+    for (size_t i = 0; i < m_rawWaitingTimes.size(); i++)
+    {
+        out << m_rawArrivalTimes[i] << " " << m_rawWaitingTimes[i] << "\n";
+    }
+    return true;
+}
+
+
+void SupermarketSimulation::ScheduleNextArrival()
+{
+    if (m_stopped)
+    {
+        return;
+    }
+   
+    double currentTime = m_engine->Now();
+    if (m_replayTrace)
+    {
+        // Once the recording runs out no further customers arrive, and the
+        // run carries on serving the queue until simulationTime.
+        if (m_replayNext < m_replayTrace->GetCount())
+        {
+            double nextArrivalTime = std::max(currentTime, m_replayTrace->GetArrival(m_replayNext));
+            if (nextArrivalTime < m_simulationTime)
+            {
+                m_engine->Schedule(m_numCashiers + ARRIVAL_EVENT, nextArrivalTime - currentTime);
+            }
+        }
+        return;
+    }
+    double interArrivalTime = m_arrivalVariates.Next();
+    if (m_arrivalSchedule)
+    {
+        double next = m_arrivalSchedule->NextArrival(currentTime, interArrivalTime * m_arrivalRate, m_scheduleBucket);
+        interArrivalTime = next - currentTime;
+    }
+    double nextArrivalTime = currentTime + interArrivalTime;
+   
+    if (nextArrivalTime < m_simulationTime)
+    {
+        m_engine->Schedule(m_numCashiers + ARRIVAL_EVENT, interArrivalTime);
+    }
+}
+
+
+// Draws the same arrivals ScheduleNextArrival would and gives each one its
+// service demand, which is the order a common-random-numbers run uses.
+void SupermarketSimulation::GenerateTrace(double simulationTime, ArrivalTrace& trace)
+{
+    trace.arrivals.clear();
+    trace.demands.clear();
+    trace.arrivals.reserve(static_cast<size_t>(m_arrivalRate * simulationTime * 1.1) + 16);
+    trace.demands.reserve(trace.arrivals.capacity());
+   
+    double currentTime = 0;
+    uint32_t bucket = 0;
+    while (true)
+    {
+        double interArrivalTime = m_arrivalVariates.Next();
+        double next = m_arrivalSchedule ?
+            m_arrivalSchedule->NextArrival(currentTime, interArrivalTime * m_arrivalRate, bucket) :
+            currentTime + interArrivalTime;
+        if (next >= simulationTime)
+        {
+            break;
+        }
+        currentTime = next;
+        trace.arrivals.push_back(currentTime);
+        trace.demands.push_back(m_serviceVariates.Next());
+    }
+}
+
+
+void SupermarketSimulation::ScheduleServiceEnd(uint32_t cashierId, double serviceTime)
+{
+    m_engine->Schedule(cashierId, serviceTime);
+}
+
+
+// A plan sets the floor of open lanes at each step. With openAbove > 0 an
+// extra lane opens whenever the queue grows past openAbove customers and
+// closes again once it finds the queue empty.
+void SupermarketSimulation::SetStaffing(std::shared_ptr<const StaffingSchedule> plan, uint32_t openAbove)
+{
+    m_staffingPlan = plan;
+    m_openAbove = openAbove;
+}
+
+
+// Switches to plan from now on: the step in force now applies at once and
+// later steps follow as usual. The run need not have been staffed before.
+void SupermarketSimulation::ReplaceStaffingPlan(std::shared_ptr<const StaffingSchedule> plan)
+{
+    double currentTime = m_engine->Now();
+    m_engine->Cancel(m_numCashiers + STAFFING_EVENT);
+    m_staffingPlan = plan;
+    m_staffingStep = 0;
+    while (m_staffingStep + 1 < plan->GetStepCount() && plan->GetStepTime(m_staffingStep + 1) <= currentTime)
+    {
+        m_staffingStep++;
+    }
+   
+    if (plan->GetStepTime(m_staffingStep) <= currentTime)
+    {
+        ChangeStaffing();
+    }
+    else if (plan->GetStepTime(0) < m_simulationTime)
+    {
+        m_engine->Schedule(m_numCashiers + STAFFING_EVENT, plan->GetStepTime(0) - currentTime);
+    }
+}
+
+
+// Calls callback from inside the event loop at time, with the model between
+// events, so it may fork the process and let each copy carry on differently.
+void SupermarketSimulation::SetBranchPoint(double time, std::function<void()> callback)
+{
+    m_branchTime = time;
+    m_branchCallback = callback;
+}
+
+
+void SupermarketSimulation::ChangeStaffing()
+{
+    double currentTime = m_engine->Now();
+    m_targetOpen = std::min(m_numCashiers, m_staffingPlan->GetStepCashiers(m_staffingStep));
+    AdjustStaffing(currentTime);
+   
+    m_staffingStep++;
+    if (m_staffingStep < m_staffingPlan->GetStepCount() &&
+        m_staffingPlan->GetStepTime(m_staffingStep) < m_simulationTime)
+    {
+        m_engine->Schedule(m_numCashiers + STAFFING_EVENT,
+                           m_staffingPlan->GetStepTime(m_staffingStep) - currentTime);
+    }
+}
+
+
+void SupermarketSimulation::AdjustStaffing(double currentTime)
+{
+    while (m_openCashiers - m_pendingCloses < m_targetOpen)
+    {
+        OpenCashier(currentTime);
+    }
+    while (m_openCashiers - m_pendingCloses > m_targetOpen)
+    {
+        CloseCashier(currentTime);
+    }
+}
+
+
+// Reopening a lane that is still draining just cancels its close.
+void SupermarketSimulation::OpenCashier(double currentTime)
+{
+    if (m_pendingCloses > 0)
+    {
+        m_pendingCloses--;
+        return;
+    }
+   
+    uint32_t cashierId = m_closedCashiers.back();
+    m_closedCashiers.pop_back();
+    RecordStaffingChange(currentTime);
+    m_openCashiers++;
+    m_laneOpenings++;
+    m_peakOpen = std::max(m_peakOpen, m_openCashiers);
+    m_cashiers[cashierId].Open(currentTime);
+   
+    uint32_t nextCustomer = m_classed ? Dequeue<true>(currentTime) : Dequeue<false>(currentTime);
+    if (nextCustomer != NO_CUSTOMER)
+    {
+        StartService(cashierId, nextCustomer, currentTime);
+    }
+    else
+    {
+        m_idleCashiers->Release(cashierId);
+    }
+}
+
+
+// An idle lane closes at once; otherwise the next lane to finish its
+// customer closes instead of taking another from the queue.
+void SupermarketSimulation::CloseCashier(double currentTime)
+{
+    if (!m_idleCashiers->Empty())
+    {
+        RetireCashier(m_idleCashiers->Acquire(), currentTime);
+    }
+    else
+    {
+        m_pendingCloses++;
+    }
+}
+
+
+void SupermarketSimulation::RetireCashier(uint32_t cashierId, double currentTime)
+{
+    RecordStaffingChange(currentTime);
+    m_openCashiers--;
+    m_laneClosings++;
+    m_cashiers[cashierId].Close(currentTime);
+    m_closedCashiers.push_back(cashierId);
+}
+
+
+void SupermarketSimulation::RecordStaffingChange(double currentTime)
+{
+    m_openLaneTime += m_openCashiers * (currentTime - m_lastStaffingChange);
+    m_lastStaffingChange = currentTime;
+}
+
+
+void SupermarketSimulation::PrintStaffingReport(std::ostream& os) const
+{
+    if (!m_staffingPlan && m_openAbove == 0)
+    {
+        return;
+    }
+   
+    double elapsed = m_lastStaffingChange;
+    os << "Staffing: " << m_laneOpenings << " lane openings, " << m_laneClosings << " closings, peak "
+       << m_peakOpen << " of " << m_numCashiers << " lanes open" << std::endl;
+    os << "Average open lanes: " << std::fixed << std::setprecision(2)
+       << ((elapsed > 0) ? m_openLaneTime / elapsed : 0) << " (" << std::setprecision(1)
+       << m_openLaneTime / 3600.0 << " lane-hours)" << std::endl;
+}
+
+
+bool SupermarketSimulation::SetTopology(const std::string& topology, const std::string& routing)
+{
+    if (!ParseTopology(topology, routing, m_laneQueues, m_routing))
+    {
+        NS_LOG_ERROR("Unknown queue topology '" << topology << "' or lane routing '" << routing << "'");
+        return false;
+    }
+    if (m_laneQueues && !m_checkpointFile.empty())
+    {
+        NS_FATAL_ERROR("Checkpoints do not hold customer classes or lane queues");
+    }
+    return true;
+}
+
+
+// The last lanes are express lanes, open only to baskets of at most
+// maxItems. A basket holds about meanItems items on average, in proportion
+// to the customer's service demand, so express lanes draw demand at arrival.
+// At least one regular lane is always kept.
+void SupermarketSimulation::SetExpressLanes(uint32_t lanes, uint32_t maxItems, double meanItems)
+{
+    m_expressLanes = lanes;
+    m_expressItems = maxItems;
+    m_meanItems = meanItems;
+}
+
+
+LaneLengthIndex& SupermarketSimulation::LaneIndex(uint32_t lane)
+{
+    return m_expressLaneIndex.Contains(lane) ? m_expressLaneIndex : m_regularLanes;
+}
+
+
+uint32_t SupermarketSimulation::RandomLane(uint32_t numLanes)
+{
+    return static_cast<uint32_t>(((m_routingRng.NextU64() >> 32) * numLanes) >> 32);
+}
+
+
+// Small baskets may join any lane and prefer an express lane on a tie;
+// the rest choose among the regular lanes only.
+uint32_t SupermarketSimulation::RouteCustomer(uint32_t customer)
+{
+    bool express = false;
+    if (!m_expressLaneIndex.Empty())
+    {
+        double items = std::max(1.0, std::round(m_customers[customer].serviceDemand * m_serviceRate * m_meanItems));
+        express = (items <= m_expressItems);
+    }
+    uint32_t lanes = express ? m_numCashiers : m_numCashiers - m_activeExpressLanes;
+   
+    uint32_t lane;
+    switch (m_routing)
+    {
+    case RANDOM_ROUTING:
+        lane = RandomLane(lanes);
+        break;
+    case POWER_OF_TWO_ROUTING:
+    {
+        uint32_t first = RandomLane(lanes);
+        uint32_t second = RandomLane(lanes);
+        lane = (LaneIndex(second).GetLength(second) < LaneIndex(first).GetLength(first)) ? second : first;
+        break;
+    }
+    default:
+        lane = m_regularLanes.Shortest();
+        if (express && m_expressLaneIndex.GetShortestLength() <= m_regularLanes.GetShortestLength())
+        {
+            lane = m_expressLaneIndex.Shortest();
+        }
+        break;
+    }
+   
+    if (m_expressLaneIndex.Contains(lane))
+    {
+        m_expressCustomers++;
+    }
+    return lane;
+}
+
+
+void SupermarketSimulation::PrintCashierBreakdown(std::ostream& os) const
+{
+    os << "Cashier | Served | Utilization" << std::endl;
+    for (uint32_t i = 0; i < m_numCashiers; i++)
+    {
+        double busy = m_cashiers[i].GetTotalServiceTime();
+        double total = busy + m_cashiers[i].GetTotalIdleTime();
+        os << std::setw(7) << i << " | " << std::setw(6) << m_cashiers[i].GetCustomersServed() << " | "
+           << std::setw(10) << std::fixed << std::setprecision(1) << ((total > 0) ? busy / total * 100 : 0) << "%"
+           << std::endl;
+    }
+}
+
+
+void SupermarketSimulation::PrintLaneReport(std::ostream& os) const
+{
+    if (!m_laneQueues || m_expressLaneIndex.Empty())
+    {
+        return;
+    }
+   
+    os << "Express lanes: " << m_activeExpressLanes << " of " << m_numCashiers << " took " << m_expressCustomers
+       << " of " << m_customerId << " arrivals" << std::endl;
+}
+
+
+void Ns3EventEngine::Reset(SupermarketSimulation* sim, uint32_t numSlots)
+{
+    Stop();
+    m_sim = sim;
+    m_events.assign(numSlots, EventId());
+}
+
+
+void Ns3EventEngine::Schedule(uint32_t slot, double delay)
+{
+    if (INSTRUMENTATION_ENABLED)
+    {
+        m_schedules++;
+    }
+    Cancel(slot);
+    m_events[slot] = Simulator::Schedule(Seconds(delay), &Ns3EventEngine::Fire, this, slot);
+}
+
+
+void Ns3EventEngine::Cancel(uint32_t slot)
+{
+    if (!m_events[slot].IsExpired())
+    {
+        if (INSTRUMENTATION_ENABLED)
+        {
+            m_cancels++;
+        }
+        Simulator::Cancel(m_events[slot]);
+    }
+}
+
+
+void Ns3EventEngine::Stop()
+{
+    for (uint32_t slot = 0; slot < m_events.size(); slot++)
+    {
+        Cancel(slot);
+    }
+    Simulator::Stop();
+}
+
+
+void Ns3EventEngine::Fire(uint32_t slot)
+{
+    m_sim->HandleEvent(slot);
+}
+
+
+void CalendarEventEngine::Run()
+{
+    m_stopped = false;
+    while (!m_stopped && !m_heap.empty())
+    {
+        uint32_t slot = m_heap[0];
+        m_now = m_time[slot];
+        RemoveAt(0);
+        m_sim->HandleEvent(slot);
+    }
+}
+
+
+CashierResults SupermarketSimulation::GetResults() const
+{
+    double totalServiceTime = m_cashiers.GetTotalServiceTime();
+    double totalIdleTime = m_cashiers.GetTotalIdleTime();
+   
+    double avgWaitingTime = m_waitStats.GetMean();
+    double utilization = (totalServiceTime + totalIdleTime > 0) ?
+        totalServiceTime / (totalServiceTime + totalIdleTime) : 0;
+   
+    double efficiencyScore = utilization / (avgWaitingTime + 1.0);
+   
+    CashierResults results;
+    results.numCashiers = m_numCashiers;
+    results.totalCustomers = m_customersServed;
+    results.avgWaitingTime = avgWaitingTime;
+    results.ciSamples = (m_batches > 0) ? m_batchMeans.GetCount() : 0;
+    results.waitingTimeCiHalfWidth = (results.ciSamples > 1) ? ConfidenceHalfWidth95(m_batchMeans) : 0;
+    results.waitingTimeStdDev = m_waitStats.GetStdDev();
+    results.minWaitingTime = m_waitStats.GetMin();
+    results.maxWaitingTime = m_waitStats.GetMax();
+    results.utilization = utilization;
+    results.efficiencyScore = efficiencyScore;
+    results.warmupTime = m_warmupTime;
+    results.waitingTimeP50 = m_waitPercentiles.Get(0);
+    results.waitingTimeP95 = m_waitPercentiles.Get(1);
+    results.waitingTimeP99 = m_waitPercentiles.Get(2);
+    results.avgQueueLength = m_queueLength.GetMean(m_endTime);
+    results.avgBusyCashiers = m_busyCashiers.GetMean(m_endTime);
+    results.counters = m_counters;
+    return results;
+}
+
+
+void SupermarketSimulation::PrintResults(std::ostream& os)
+{
+    CashierResults results = GetResults();
+    RecordResults(results);
+    PrintCashierResults(results, os);
+}
+
+
+struct SweepParameters
+{
+    uint32_t maxCashiers;
+    double arrivalRate;
+    double serviceRate;
+    double simulationTime;
+    uint32_t workers;
+    bool keepRawSamples;
+    bool customerTrace;
+    std::string cashierSelection;
+    bool analyticPrune;
+    double pruneMargin;
+    uint32_t replications;
+    uint32_t batches;
+    uint32_t minSamples;
+    double ciHalfWidth;
+    double warmupTime;
+    bool autoWarmup;
+    double warmupPilotTime;
+    std::string search;
+    double targetWait;
+    bool commonRandomNumbers;
+    std::string engine;
+    std::string randomSource;
+    std::string arrivalDistribution;
+    std::string serviceDistribution;
+    std::shared_ptr<const DistributionSpec> arrivalSpec;
+    std::shared_ptr<const DistributionSpec> serviceSpec;
+    std::shared_ptr<const ArrivalRateSchedule> arrivalSchedule;
+    std::shared_ptr<const StaffingSchedule> staffingPlan;
+    uint32_t openAbove;
+    std::string topology;
+    std::string routing;
+    uint32_t expressLanes;
+    uint32_t expressItems;
+    double meanItems;
+    bool columnarOutput;
+    uint32_t traceSampleEvery;
+    std::string traceCompression;
+    bool perCashierStats;
+    bool traceSweep;
+    std::shared_ptr<const MappedTrace> replayTrace;
+    std::string checkpoint;
+    double checkpointInterval;
+    bool resume;
+    double priorityShare;
+    uint32_t balkAbove;
+    double meanPatience;
+    std::string plotFormat;
+    bool storeReports;
+};
+
+
+struct BranchPlan
+{
+    std::string name;
+    std::shared_ptr<const StaffingSchedule> plan;
+};
+
+
+// With common random numbers every cashier count replays the same arrival
+// and service-demand streams, and service is drawn when a customer arrives.
+// Customer n then brings the same demand whatever the configuration, so
+// differences between counts are not buried in sampling noise.
+int64_t SelectStreamBase(uint32_t numCashiers, const SweepParameters& params)
+{
+    return params.commonRandomNumbers ? 0 : 2 * static_cast<int64_t>(numCashiers - 1);
+}
+
+
+void ConfigureRandomNumbers(SupermarketSimulation& sim, uint32_t numCashiers, const SweepParameters& params)
+{
+    sim.SetRandomSource(params.randomSource);
+    sim.SetArrivalDistribution(params.arrivalSpec);
+    sim.SetServiceDistribution(params.serviceSpec);
+    sim.AssignStreams(SelectStreamBase(numCashiers, params));
+    sim.SetServiceAtArrival(params.commonRandomNumbers || params.expressLanes > 0);
+    sim.SetEngine(params.engine);
+}
+
+
+// With analytic pruning only stable cashier counts whose Erlang-C utilization
+// lies within pruneMargin of the recommendation band are simulated.
+std::vector<uint32_t> SelectSweepConfigurations(const SweepParameters& params)
+{
+    std::vector<uint32_t> configurations;
+    ErlangCModel model(params.arrivalRate, params.serviceRate);
+    uint32_t firstStable = 0;
+   
+    for (uint32_t numCashiers = 1; numCashiers <= params.maxCashiers; numCashiers++)
+    {
+        if (!params.analyticPrune)
+        {
+            configurations.push_back(numCashiers);
+            continue;
+        }
+       
+        AnalyticResults analytic = model.Evaluate(numCashiers);
+        if (!analytic.stable)
+        {
+            continue;
+        }
+        if (firstStable == 0)
+        {
+            firstStable = numCashiers;
+        }
+        if (analytic.utilization >= DEFAULT_MIN_UTILIZATION - params.pruneMargin &&
+            analytic.utilization <= DEFAULT_MAX_UTILIZATION + params.pruneMargin)
+        {
+            configurations.push_back(numCashiers);
+        }
+    }
+   
+    if (configurations.empty() && firstStable > 0)
+    {
+        configurations.push_back(firstStable);
+    }
+    return configurations;
+}
+
+
+// FNV-1a over the contents of the files a run reads: staffing plan, arrival
+// schedule and empirical histograms. A replayed trace can be many gigabytes,
+// so it contributes its size, modification time and first records only.
+// Part of the checkpoint key, so editing one of them invalidates checkpoints
+// taken before.
+uint64_t HashInputFiles(const SweepParameters& params)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    auto add = [&hash](const void* data, size_t size) {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; i++)
+        {
+            hash = (hash ^ bytes[i]) * 1099511628211ULL;
+        }
+    };
+    auto addVector = [&add](const auto& values) { add(values.data(), values.size() * sizeof(values[0])); };
+   
+    if (params.staffingPlan)
+    {
+        for (uint32_t step = 0; step < params.staffingPlan->GetStepCount(); step++)
+        {
+            double time = params.staffingPlan->GetStepTime(step);
+            uint32_t cashiers = params.staffingPlan->GetStepCashiers(step);
+            add(&time, sizeof(time));
+            add(&cashiers, sizeof(cashiers));
+        }
+    }
+    if (params.arrivalSchedule)
+    {
+        for (uint32_t bucket = 0; bucket < params.arrivalSchedule->GetBucketCount(); bucket++)
+        {
+            double start = params.arrivalSchedule->GetBucketStart(bucket);
+            double rate = params.arrivalSchedule->GetBucketRate(bucket);
+            add(&start, sizeof(start));
+            add(&rate, sizeof(rate));
+        }
+    }
+    if (params.replayTrace)
+    {
+        uint64_t size = params.replayTrace->GetFileSize();
+        int64_t modified = params.replayTrace->GetModified();
+        add(&size, sizeof(size));
+        add(&modified, sizeof(modified));
+        uint64_t prefix = std::min<uint64_t>(params.replayTrace->GetCount(), MappedTrace::PREFETCH_RECORDS);
+        for (uint64_t i = 0; i < prefix; i++)
+        {
+            double record[2] = {params.replayTrace->GetArrival(i), params.replayTrace->GetDemand(i)};
+            add(record, sizeof(record));
+        }
+    }
+    for (auto& spec : {params.arrivalSpec, params.serviceSpec})
+    {
+        if (spec && spec->histogram)
+        {
+            addVector(spec->histogram->lower);
+            addVector(spec->histogram->width);
+            addVector(spec->histogram->probability);
+        }
+    }
+    return hash;
+}
+
+
+// Streams are pinned by SelectStreamBase, so a run produces the same numbers
+// whether it executes in this process or in a sweep worker.
+CashierResults RunReplication(uint32_t numCashiers, const SweepParameters& params, double warmupTime,
+                              bool writeOutputs, std::ostream* details = nullptr)
+{
+    SupermarketSimulation sim(numCashiers, params.arrivalRate, params.serviceRate);
+    ConfigureRandomNumbers(sim, numCashiers, params);
+    sim.SetWarmupTime(warmupTime);
+    sim.SetKeepRawSamples(params.keepRawSamples && writeOutputs);
+    sim.SetCashierSelection(params.cashierSelection);
+    sim.SetBatchMeans(params.batches, params.minSamples, params.ciHalfWidth);
+    sim.SetArrivalSchedule(params.arrivalSchedule);
+    sim.SetReplayTrace(params.replayTrace);
+    sim.SetStaffing(params.staffingPlan, params.openAbove);
+    sim.SetTopology(params.topology, params.routing);
+    sim.SetExpressLanes(params.expressLanes, params.expressItems, params.meanItems);
+    sim.SetCustomerClasses(params.priorityShare, params.balkAbove, params.meanPatience);
+    if (!params.checkpoint.empty() && writeOutputs)
+    {
+        std::ostringstream filename;
+        filename << params.checkpoint << "_" << numCashiers << ".ckpt";
+        std::ostringstream key;
+        key << std::setprecision(17) << numCashiers << " " << params.arrivalRate << " " << params.serviceRate << " "
+            << params.simulationTime << " " << warmupTime << " " << params.batches << " " << params.ciHalfWidth << " "
+            << params.randomSource << " " << params.arrivalDistribution << " " << params.serviceDistribution << " "
+            << params.cashierSelection << " " << params.commonRandomNumbers << " " << params.openAbove << " "
+            << params.engine << " " << params.topology << " " << params.routing << " " << params.expressLanes << " "
+            << params.expressItems << " " << params.meanItems << " " << params.priorityShare << " "
+            << params.balkAbove << " " << params.meanPatience << " " << HashInputFiles(params) << " "
+            << RngSeedManager::GetSeed() << " " << RngSeedManager::GetRun();
+        sim.SetCheckpoint(filename.str(), params.checkpointInterval, params.resume, key.str());
+    }
+    if (params.customerTrace && writeOutputs)
+    {
+        std::ostringstream filename;
+        filename << "customer_trace_" << numCashiers << (params.columnarOutput ? ".bin" : ".dat");
+        std::string compressor;
+        if (params.traceCompression == "zstd")
+        {
+            filename << ".zst";
+            compressor = "zstd -q -c";
+        }
+        else if (params.traceCompression == "gzip")
+        {
+            filename << ".gz";
+            compressor = "gzip -c";
+        }
+        sim.EnableCustomerTrace(filename.str(), params.columnarOutput, params.traceSampleEvery, compressor);
+    }
+   
+    sim.RunSimulation(params.simulationTime);
+   
+    CashierResults results = sim.GetResults();
+    if (details != nullptr)
+    {
+        if (params.perCashierStats)
+        {
+            sim.PrintCashierBreakdown(*details);
+        }
+        sim.PrintStaffingReport(*details);
+        sim.PrintLaneReport(*details);
+        sim.PrintClassReport(*details);
+        sim.PrintBucketReport(*details, params.targetWait);
+    }
+   
+    if (params.keepRawSamples && writeOutputs)
+    {
+        std::ostringstream filename;
+        filename << "waiting_times_" << numCashiers << (params.columnarOutput ? ".bin" : ".dat");
+        sim.WriteWaitingTimes(filename.str(), params.columnarOutput);
+    }
+   
+    Simulator::Destroy();
+    return results;
+}
+
+
+// Without warmupPilotTime the pilot covers this share of the run; MSER-5
+// only looks at the first half of it anyway.
+const double DEFAULT_PILOT_FRACTION = 0.25;
+
+
+// Runs a pilot on the configuration's own streams, keeping every sample, and
+// returns the arrival time of the first sample MSER-5 keeps.
+double DetectWarmupTime(uint32_t numCashiers, const SweepParameters& params)
+{
+    SupermarketSimulation sim(numCashiers, params.arrivalRate, params.serviceRate);
+    ConfigureRandomNumbers(sim, numCashiers, params);
+    sim.SetKeepRawSamples(true);
+    sim.SetCashierSelection(params.cashierSelection);
+    sim.SetArrivalSchedule(params.arrivalSchedule);
+    sim.SetReplayTrace(params.replayTrace);
+    sim.SetStaffing(params.staffingPlan, params.openAbove);
+    sim.SetTopology(params.topology, params.routing);
+    sim.SetExpressLanes(params.expressLanes, params.expressItems, params.meanItems);
+    sim.SetCustomerClasses(params.priorityShare, params.balkAbove, params.meanPatience);
+    sim.RunSimulation((params.warmupPilotTime > 0) ? params.warmupPilotTime :
+                                                     params.simulationTime * DEFAULT_PILOT_FRACTION);
+   
+    const std::vector<double>& waits = sim.GetWaitingTimes();
+    const std::vector<double>& arrivals = sim.GetArrivalTimes();
+    std::vector<size_t> order(waits.size());
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(),
+        [&arrivals](size_t a, size_t b) {
+            return arrivals[a] < arrivals[b];
+        });
+   
+    std::vector<double> samples(order.size());
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        samples[i] = waits[order[i]];
+    }
+   
+    size_t truncation = Mser5TruncationPoint(samples);
+    double warmupTime = (truncation > 0) ? arrivals[order[truncation]] : 0;
+    Simulator::Destroy();
+    return warmupTime;
+}
+
+
+double SelectWarmupTime(uint32_t numCashiers, const SweepParameters& params)
+{
+    if (!params.autoWarmup)
+    {
+        return params.warmupTime;
+    }
+    double detected = DetectWarmupTime(numCashiers, params);
+    if (detected >= params.simulationTime)
+    {
+        NS_LOG_ERROR("MSER-5 warm-up " << detected << " s for " << numCashiers
+                     << " cashiers leaves no run, keeping " << params.warmupTime << " s");
+        return params.warmupTime;
+    }
+    return std::max(params.warmupTime, detected);
+}
+
+
+// Independent replications use consecutive ns-3 run numbers. They stop once
+// the 95% CI on the mean wait is within ciHalfWidth (after minSamples runs)
+// or when params.replications runs are done. Traces and raw samples come
+// from the first replication only.
+CashierResults RunReplications(uint32_t numCashiers, const SweepParameters& params, double warmupTime,
+                               std::ostream& details)
+{
+    uint64_t baseRun = RngSeedManager::GetRun();
+    uint32_t minReplications = std::min(std::max<uint32_t>(params.minSamples, 2), params.replications);
+    WaitingTimeStats waitMeans;
+    WaitingTimeStats utilizations;
+    WaitingTimeStats customers;
+    WaitingTimeStats stdDevs;
+    WaitingTimeStats p50s;
+    WaitingTimeStats p95s;
+    WaitingTimeStats p99s;
+    WaitingTimeStats queueLengths;
+    WaitingTimeStats busyCashiers;
+    double minWait = std::numeric_limits<double>::max();
+    double maxWait = 0;
+    RunCounters counters = RunCounters();
+   
+    for (uint32_t r = 0; r < params.replications; r++)
+    {
+        RngSeedManager::SetRun(baseRun + r);
+        CashierResults run = RunReplication(numCashiers, params, warmupTime, r == 0, (r == 0) ? &details : nullptr);
+        waitMeans.Add(run.avgWaitingTime);
+        utilizations.Add(run.utilization);
+        customers.Add(run.totalCustomers);
+        stdDevs.Add(run.waitingTimeStdDev);
+        p50s.Add(run.waitingTimeP50);
+        p95s.Add(run.waitingTimeP95);
+        p99s.Add(run.waitingTimeP99);
+        queueLengths.Add(run.avgQueueLength);
+        busyCashiers.Add(run.avgBusyCashiers);
+        minWait = std::min(minWait, run.minWaitingTime);
+        maxWait = std::max(maxWait, run.maxWaitingTime);
+        counters.Add(run.counters);
+       
+        if (params.ciHalfWidth > 0 && r + 1 >= minReplications &&
+            ConfidenceHalfWidth95(waitMeans) <= params.ciHalfWidth)
+        {
+            break;
+        }
+    }
+    RngSeedManager::SetRun(baseRun);
+   
+    CashierResults results;
+    results.numCashiers = numCashiers;
+    results.totalCustomers = static_cast<uint32_t>(std::lround(customers.GetMean()));
+    results.avgWaitingTime = waitMeans.GetMean();
+    results.ciSamples = waitMeans.GetCount();
+    results.waitingTimeCiHalfWidth = ConfidenceHalfWidth95(waitMeans);
+    results.waitingTimeStdDev = stdDevs.GetMean();
+    results.minWaitingTime = minWait;
+    results.maxWaitingTime = maxWait;
+    results.utilization = utilizations.GetMean();
+    results.efficiencyScore = results.utilization / (results.avgWaitingTime + 1.0);
+    results.warmupTime = warmupTime;
+    results.waitingTimeP50 = p50s.GetMean();
+    results.waitingTimeP95 = p95s.GetMean();
+    results.waitingTimeP99 = p99s.GetMean();
+    results.avgQueueLength = queueLengths.GetMean();
+    results.avgBusyCashiers = busyCashiers.GetMean();
+    results.counters = counters;
+    return results;
+}
+
+
+void RunCashierConfiguration(uint32_t numCashiers, const SweepParameters& params, std::ostream& os)
+{
+    double warmupTime = SelectWarmupTime(numCashiers, params);
+    std::ostringstream details;
+    CashierResults results = (params.replications > 1) ?
+        RunReplications(numCashiers, params, warmupTime, details) :
+        RunReplication(numCashiers, params, warmupTime, true, &details);
+    auto reportStart = InstrumentationNow();
+    PrintCashierResults(results, os);
+    results.counters.reportSeconds = std::chrono::duration<double>(InstrumentationNow() - reportStart).count();
+    RecordResults(results);
+    if (INSTRUMENTATION_ENABLED)
+    {
+        PrintRunCounters(results.counters, os);
+    }
+    os << details.str();
+   
+    if (params.topology == "lanes")
+    {
+        SweepParameters pooled = params;
+        pooled.topology = "pooled";
+        CashierResults baseline = RunReplication(numCashiers, pooled, warmupTime, false);
+        os << "Pooled queue on the same arrivals: average wait " << std::fixed << std::setprecision(2)
+           << baseline.avgWaitingTime << " seconds, utilization " << std::setprecision(1)
+           << baseline.utilization * 100 << "%" << std::endl;
+    }
+}
+
+
+void RunSerialSweep(const SweepParameters& params, const std::vector<uint32_t>& configurations)
+{
+    for (uint32_t numCashiers : configurations)
+    {
+        RunCashierConfiguration(numCashiers, params, std::cout);
+    }
+}
+
+
+bool WriteAll(int fd, const void* data, size_t size)
+{
+    const char* bytes = static_cast<const char*>(data);
+    while (size > 0)
+    {
+        ssize_t written = write(fd, bytes, size);
+        if (written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (written <= 0)
+        {
+            return false;
+        }
+        bytes += written;
+        size -= written;
+    }
+    return true;
+}
+
+
+bool ReadAll(int fd, void* data, size_t size)
+{
+    char* bytes = static_cast<char*>(data);
+    while (size > 0)
+    {
+        ssize_t received = read(fd, bytes, size);
+        if (received < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (received <= 0)
+        {
+            return false;
+        }
+        bytes += received;
+        size -= received;
+    }
+    return true;
+}
+
+
+struct SweepWorker
+{
+    uint32_t id;
+    pid_t pid;
+    int fd;
+};
+
+
+// Runs task in a forked copy of this process, which gives it a private
+// Simulator, and streams the bytes the task returns back to the parent.
+SweepWorker StartWorker(uint32_t id, const std::function<std::string()>& task)
+{
+    SweepWorker worker = {id, -1, -1};
+    int fds[2];
+    if (pipe(fds) != 0)
+    {
+        NS_LOG_ERROR("Could not create pipe for worker " << id);
+        return worker;
+    }
+   
+    std::cout.flush();
+    std::clog.flush();
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        NS_LOG_ERROR("Could not fork worker " << id);
+        close(fds[0]);
+        close(fds[1]);
+        return worker;
+    }
+   
+    if (pid == 0)
+    {
+        close(fds[0]);
+        std::string payload = task();
+        uint64_t payloadSize = payload.size();
+        bool ok = WriteAll(fds[1], &payloadSize, sizeof(payloadSize)) &&
+                  WriteAll(fds[1], payload.data(), payload.size());
+        close(fds[1]);
+        _exit(ok ? 0 : 1);
+    }
+   
+    close(fds[1]);
+    worker.pid = pid;
+    worker.fd = fds[0];
+    return worker;
+}
+
+
+bool FinishWorker(const SweepWorker& worker, std::string& payload)
+{
+    if (worker.pid < 0)
+    {
+        return false;
+    }
+   
+    uint64_t payloadSize = 0;
+    bool ok = ReadAll(worker.fd, &payloadSize, sizeof(payloadSize));
+    if (ok)
+    {
+        payload.resize(payloadSize);
+        ok = ReadAll(worker.fd, &payload[0], payloadSize);
+    }
+    close(worker.fd);
+   
+    int status = 0;
+    while (waitpid(worker.pid, &status, 0) < 0 && errno == EINTR)
+    {
+    }
+    return ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+
+// A sweep worker sends back its CashierResults followed by the text
+// PrintResults would have written.
+SweepWorker StartSweepWorker(uint32_t numCashiers, const SweepParameters& params)
+{
+    return StartWorker(numCashiers, [numCashiers, &params]() {
+        allResults.clear();
+        std::ostringstream text;
+        RunCashierConfiguration(numCashiers, params, text);
+        CashierResults results = allResults.back();
+        return std::string(reinterpret_cast<const char*>(&results), sizeof(results)) + text.str();
+    });
+}
+
+
+bool FinishSweepWorker(const SweepWorker& worker)
+{
+    std::string payload;
+    if (!FinishWorker(worker, payload) || payload.size() < sizeof(CashierResults))
+    {
+        return false;
+    }
+   
+    CashierResults results;
+    std::memcpy(&results, payload.data(), sizeof(results));
+    RecordResults(results);
+    std::cout << payload.substr(sizeof(results));
+    return true;
+}
+
+
+// Results are collected in cashier order regardless of which worker finishes
+// first, so the output matches RunSerialSweep line for line.
+void RunParallelSweep(const SweepParameters& params, const std::vector<uint32_t>& configurations)
+{
+    std::deque<SweepWorker> running;
+    size_t next = 0;
+   
+    while (next < configurations.size() || !running.empty())
+    {
+        while (next < configurations.size() && running.size() < params.workers)
+        {
+            running.push_back(StartSweepWorker(configurations[next], params));
+            next++;
+        }
+       
+        SweepWorker worker = running.front();
+        running.pop_front();
+        if (!FinishSweepWorker(worker))
+        {
+            NS_LOG_ERROR("Sweep worker for " << worker.id << " cashiers failed, running it in-process");
+            RunCashierConfiguration(worker.id, params, std::cout);
+        }
+    }
+}
+
+
+double Overlap(double begin, double end, double windowBegin, double windowEnd)
+{
+    return std::max(0.0, std::min(end, windowEnd) - std::max(begin, windowBegin));
+}
+
+
+// FCFS with identical cashiers needs no events: customer n starts at the later
+// of its arrival and the earliest time any cashier frees up (the
+// Kiefer-Wolfowitz workload recurrence), kept here as a min-heap of free
+// times, so one pass costs O(n log c). Accounting matches a run: service in
+// progress at the end is cut off there and customers still queued are not
+// served.
+CashierResults EvaluateTrace(const ArrivalTrace& trace, uint32_t numCashiers, double simulationTime,
+                             double warmupTime)
+{
+    std::vector<double> freeAt(numCashiers, 0.0);
+    WaitingTimeStats waits;
+    P2Quantiles percentiles(0.50, 0.95, 0.99);
+    double busyTime = 0;
+    double queueArea = 0;
+    uint32_t served = 0;
+    size_t count = trace.arrivals.size();
+    size_t i = 0;
+   
+    for (; i < count; i++)
+    {
+        double arrival = trace.arrivals[i];
+        double start = std::max(arrival, freeAt.front());
+        if (start >= simulationTime)
+        {
+            break;
+        }
+        double end = start + trace.demands[i];
+        std::pop_heap(freeAt.begin(), freeAt.end(), std::greater<double>());
+        freeAt.back() = end;
+        std::push_heap(freeAt.begin(), freeAt.end(), std::greater<double>());
+       
+        busyTime += Overlap(start, end, warmupTime, simulationTime);
+        queueArea += Overlap(arrival, start, warmupTime, simulationTime);
+        if (arrival >= warmupTime)
+        {
+            double waitingTime = start - arrival;
+            waits.Add(waitingTime);
+            percentiles.Add(waitingTime);
+            served++;
+        }
+    }
+    // Start times never decrease, so everyone after the first customer left
+    // waiting at the end is still queued too.
+    for (; i < count; i++)
+    {
+        queueArea += Overlap(trace.arrivals[i], simulationTime, warmupTime, simulationTime);
+    }
+   
+    double span = simulationTime - warmupTime;
+    CashierResults results = CashierResults();
+    results.numCashiers = numCashiers;
+    results.totalCustomers = served;
+    results.avgWaitingTime = waits.GetMean();
+    results.waitingTimeStdDev = waits.GetStdDev();
+    results.minWaitingTime = waits.GetMin();
+    results.maxWaitingTime = waits.GetMax();
+    results.utilization = (span > 0) ? busyTime / (span * numCashiers) : 0;
+    results.efficiencyScore = results.utilization / (results.avgWaitingTime + 1.0);
+    results.warmupTime = warmupTime;
+    results.waitingTimeP50 = percentiles.Get(0);
+    results.waitingTimeP95 = percentiles.Get(1);
+    results.waitingTimeP99 = percentiles.Get(2);
+    results.avgQueueLength = (span > 0) ? queueArea / span : 0;
+    results.avgBusyCashiers = (span > 0) ? busyTime / span : 0;
+    return results;
+}
+
+
+// Generates one trace from the common-random-numbers streams and replays it
+// for every configuration. Forked workers inherit the trace rather than
+// regenerating it.
+void GenerateSweepTrace(const SweepParameters& params, ArrivalTrace& trace)
+{
+    SweepParameters crn = params;
+    crn.commonRandomNumbers = true;
+    SupermarketSimulation generator(1, params.arrivalRate, params.serviceRate);
+    ConfigureRandomNumbers(generator, 1, crn);
+    generator.SetArrivalSchedule(params.arrivalSchedule);
+    generator.GenerateTrace(params.simulationTime, trace);
+}
+
+
+void RunTraceSweep(const SweepParameters& params, const std::vector<uint32_t>& configurations)
+{
+    ArrivalTrace trace;
+    GenerateSweepTrace(params, trace);
+    std::cout << "Trace sweep: " << trace.arrivals.size() << " arrivals generated once for "
+              << configurations.size() << " cashier counts" << std::endl;
+   
+    std::deque<SweepWorker> running;
+    size_t next = 0;
+    while (next < configurations.size() || !running.empty())
+    {
+        while (next < configurations.size() && running.size() < params.workers && params.workers > 1)
+        {
+            uint32_t numCashiers = configurations[next];
+            running.push_back(StartWorker(numCashiers, [&trace, numCashiers, &params]() {
+                CashierResults results = EvaluateTrace(trace, numCashiers, params.simulationTime, params.warmupTime);
+                return std::string(reinterpret_cast<const char*>(&results), sizeof(results));
+            }));
+            next++;
+        }
+       
+        CashierResults results;
+        if (running.empty())
+        {
+            results = EvaluateTrace(trace, configurations[next], params.simulationTime, params.warmupTime);
+            next++;
+        }
+        else
+        {
+            SweepWorker worker = running.front();
+            running.pop_front();
+            std::string payload;
+            if (FinishWorker(worker, payload) && payload.size() == sizeof(results))
+            {
+                std::memcpy(&results, payload.data(), sizeof(results));
+            }
+            else
+            {
+                NS_LOG_ERROR("Trace worker for " << worker.id << " cashiers failed, running it in-process");
+                results = EvaluateTrace(trace, worker.id, params.simulationTime, params.warmupTime);
+            }
+        }
+        PrintCashierResults(results, std::cout);
+        RecordResults(results);
+    }
+}
+
+
+// Runs maxCashiers lanes up to branchAt once, then forks one process per plan
+// from inside the event loop, so every branch starts from the same warm state
+// shared copy-on-write. A branch switches to its plan and its own random
+// substream and finishes the run; the parent finishes as the base case.
+// Statistics cover only the time after branchAt.
+void RunBranches(const SweepParameters& params, const std::vector<BranchPlan>& plans, double branchAt)
+{
+    SupermarketSimulation sim(params.maxCashiers, params.arrivalRate, params.serviceRate);
+    ConfigureRandomNumbers(sim, params.maxCashiers, params);
+    sim.SetWarmupTime(branchAt);
+    sim.SetCashierSelection(params.cashierSelection);
+    sim.SetBatchMeans(params.batches, params.minSamples, params.ciHalfWidth);
+    sim.SetArrivalSchedule(params.arrivalSchedule);
+    sim.SetReplayTrace(params.replayTrace);
+    sim.SetStaffing(params.staffingPlan, params.openAbove);
+    sim.SetCustomerClasses(params.priorityShare, params.balkAbove, params.meanPatience);
+   
+    uint32_t branch = 0;
+    int resultFd = -1;
+    std::vector<SweepWorker> children;
+    sim.SetBranchPoint(branchAt, [&]() {
+        for (uint32_t b = 1; b <= plans.size(); b++)
+        {
+            int fds[2];
+            if (pipe(fds) != 0)
+            {
+                NS_LOG_ERROR("Could not create pipe for branch " << plans[b - 1].name);
+                continue;
+            }
+            std::cout.flush();
+            std::clog.flush();
+            pid_t pid = fork();
+            if (pid == 0)
+            {
+                close(fds[0]);
+                for (auto& child : children)
+                {
+                    close(child.fd);
+                }
+                children.clear();
+                branch = b;
+                resultFd = fds[1];
+                sim.AssignStreams(BRANCH_STREAM + 2 * static_cast<int64_t>(b));
+                sim.ReplaceStaffingPlan(plans[b - 1].plan);
+                return;
+            }
+            close(fds[1]);
+            if (pid < 0)
+            {
+                NS_LOG_ERROR("Could not fork branch " << plans[b - 1].name);
+                close(fds[0]);
+                continue;
+            }
+            children.push_back({b, pid, fds[0]});
+        }
+    });
+    sim.RunSimulation(params.simulationTime);
+    CashierResults results = sim.GetResults();
+   
+    if (branch > 0)
+    {
+        uint64_t payloadSize = sizeof(results);
+        bool ok = WriteAll(resultFd, &payloadSize, sizeof(payloadSize)) && WriteAll(resultFd, &results, sizeof(results));
+        close(resultFd);
+        _exit(ok ? 0 : 1);
+    }
+    Simulator::Destroy();
+   
+    std::cout << "\nBranches from " << branchAt << " seconds (statistics after the branch point)" << std::endl;
+    std::cout << "Branch               | Customers | Avg Wait | p95 Wait | Utilization" << std::endl;
+    std::cout << "---------------------|-----------|----------|----------|------------" << std::endl;
+    auto printRow = [](const std::string& name, const CashierResults& row) {
+        std::cout << std::left << std::setw(20) << name.substr(0, 20) << std::right << " | "
+                  << std::setw(9) << row.totalCustomers << " | "
+                  << std::setw(8) << std::fixed << std::setprecision(2) << row.avgWaitingTime << " | "
+                  << std::setw(8) << row.waitingTimeP95 << " | "
+                  << std::setw(10) << std::setprecision(1) << row.utilization * 100 << "%" << std::endl;
+    };
+    printRow("base", results);
+    for (auto& child : children)
+    {
+        std::string payload;
+        CashierResults branchResults;
+        if (!FinishWorker(child, payload) || payload.size() != sizeof(branchResults))
+        {
+            NS_LOG_ERROR("Branch " << plans[child.id - 1].name << " failed");
+            continue;
+        }
+        std::memcpy(&branchResults, payload.data(), sizeof(branchResults));
+        printRow(plans[child.id - 1].name, branchResults);
+    }
+}
+
+
+// Average wait and utilization both fall as cashiers are added, so "meets
+// the target" is monotone in the cashier count and can be searched for.
+// Without a wait target the upper edge of the utilization band is used.
+bool MeetsSearchTarget(double avgWaitingTime, double utilization, const SweepParameters& params)
+{
+    if (params.targetWait > 0)
+    {
+        return avgWaitingTime <= params.targetWait;
+    }
+    return utilization <= DEFAULT_MAX_UTILIZATION;
+}
+
+
+class CashierSearch
+{
+public:
+    CashierSearch(const SweepParameters& params, std::ostream& os = std::cout);
+    uint32_t Run();
+    uint32_t GetSimulations() const { return m_probed.size(); }
+   
+private:
+    bool Probe(uint32_t numCashiers);
+    uint32_t Bisect(uint32_t low, uint32_t high);
+    uint32_t AnalyticSeeded(uint32_t low, uint32_t high);
+   
+    const SweepParameters& m_params;
+    std::ostream& m_os;
+    ErlangCModel m_model;
+    std::map<uint32_t, bool> m_probed;
+};
+
+
+CashierSearch::CashierSearch(const SweepParameters& params, std::ostream& os)
+    : m_params(params), m_os(os), m_model(params.arrivalRate, params.serviceRate)
+{
+}
+
+
+bool CashierSearch::Probe(uint32_t numCashiers)
+{
+    auto it = m_probed.find(numCashiers);
+    if (it != m_probed.end())
+    {
+        return it->second;
+    }
+   
+    RunCashierConfiguration(numCashiers, m_params, m_os);
+    const CashierResults& results = allResults.back();
+    bool meets = MeetsSearchTarget(results.avgWaitingTime, results.utilization, m_params);
+    m_probed[numCashiers] = meets;
+    return meets;
+}
+
+
+// Smallest count in [low, high] meeting the target, or 0 if even high fails.
+uint32_t CashierSearch::Bisect(uint32_t low, uint32_t high)
+{
+    if (!Probe(high))
+    {
+        return 0;
+    }
+    while (low < high)
+    {
+        uint32_t mid = low + (high - low) / 2;
+        if (Probe(mid))
+        {
+            high = mid;
+        }
+        else
+        {
+            low = mid + 1;
+        }
+    }
+    return high;
+}
+
+
+// Starts from the Erlang-C answer and walks to the simulated boundary, which
+// usually takes two or three runs.
+uint32_t CashierSearch::AnalyticSeeded(uint32_t low, uint32_t high)
+{
+    uint32_t seed = high;
+    for (uint32_t c = low; c <= high; c++)
+    {
+        AnalyticResults analytic = m_model.Evaluate(c);
+        if (analytic.stable && MeetsSearchTarget(analytic.avgWaitingTime, analytic.utilization, m_params))
+        {
+            seed = c;
+            break;
+        }
+    }
+   
+    uint32_t c = seed;
+    if (Probe(c))
+    {
+        while (c > low && Probe(c - 1))
+        {
+            c--;
+        }
+        return c;
+    }
+    while (c < high)
+    {
+        c++;
+        if (Probe(c))
+        {
+            return c;
+        }
+    }
+    return 0;
+}
+
+
+uint32_t CashierSearch::Run()
+{
+    uint32_t low = 1;
+    while (low < m_params.maxCashiers && !m_model.Evaluate(low).stable)
+    {
+        low++;
+    }
+   
+    uint32_t found = (m_params.search == "analytic") ?
+        AnalyticSeeded(low, m_params.maxCashiers) : Bisect(low, m_params.maxCashiers);
+   
+    std::sort(allResults.begin(), allResults.end(),
+        [](const CashierResults& a, const CashierResults& b) {
+            return a.numCashiers < b.numCashiers;
+        });
+    return found;
+}
+
+
+uint32_t FindOptimalCashiers(double minUtilization = DEFAULT_MIN_UTILIZATION,
+                             double maxUtilization = DEFAULT_MAX_UTILIZATION)
+{
+    if (allResults.empty())
+    {
+        return 0;
+    }
+   
+    std::vector<CashierResults> goodResults;
+    for (auto& result : allResults)
+    {
+        if (result.utilization >= minUtilization && result.utilization <= maxUtilization)
+        {
+            goodResults.push_back(result);
+        }
+    }
+   
+    if (goodResults.empty())
+    {
+        uint32_t bestCashiers = allResults[0].numCashiers;
+        double bestScore = allResults[0].efficiencyScore;
+       
+        for (auto& result : allResults)
+        {
+            if (result.efficiencyScore > bestScore)
+            {
+                bestScore = result.efficiencyScore;
+                bestCashiers = result.numCashiers;
+            }
+        }
+        return bestCashiers;
+    }
+   
+    uint32_t bestCashiers = goodResults[0].numCashiers;
+    double bestWaitingTime = goodResults[0].avgWaitingTime;
+   
+    for (auto& result : goodResults)
+    {
+        if (result.avgWaitingTime < bestWaitingTime)
+        {
+            bestWaitingTime = result.avgWaitingTime;
+            bestCashiers = result.numCashiers;
+        }
+    }
+   
+    return bestCashiers;
+}
+
+
+void PrintAnalyticValidation(double arrivalRate, double serviceRate)
+{
+    ErlangCModel model(arrivalRate, serviceRate);
+   
+    std::cout << "\n Analytic Validation (Erlang-C) " << std::endl;
+    std::cout << "Cashiers | Sim Wait | Analytic Wait | Wait Error | Sim Util | Analytic Util" << std::endl;
+    std::cout << "---------|----------|---------------|------------|----------|--------------" << std::endl;
+   
+    for (auto& result : allResults)
+    {
+        AnalyticResults analytic = model.Evaluate(result.numCashiers);
+        std::cout << std::setw(8) << result.numCashiers << " | "
+                  << std::setw(8) << std::fixed << std::setprecision(3) << result.avgWaitingTime << " | ";
+        if (!analytic.stable)
+        {
+            std::cout << std::setw(13) << "unstable" << " | " << std::setw(10) << "-" << " | ";
+        }
+        else
+        {
+            std::cout << std::setw(13) << std::fixed << std::setprecision(3) << analytic.avgWaitingTime << " | ";
+            if (analytic.avgWaitingTime > 0)
+            {
+                double error = (result.avgWaitingTime - analytic.avgWaitingTime) / analytic.avgWaitingTime;
+                std::cout << std::setw(9) << std::fixed << std::setprecision(1) << error * 100 << "% | ";
+            }
+            else
+            {
+                std::cout << std::setw(10) << "-" << " | ";
+            }
+        }
+        std::cout << std::setw(7) << std::fixed << std::setprecision(1) << result.utilization * 100 << "% | "
+                  << std::setw(12) << std::fixed << std::setprecision(1) << analytic.utilization * 100 << "%" << std::endl;
+    }
+}
+
+
+// Per-configuration summary in the ColumnarWriter format, one row per
+// cashier count in ascending order.
+bool WriteColumnarResults(const std::vector<CashierResults>& sortedResults, const std::string& filename,
+                          std::ostream& log)
+{
+    ColumnarWriter writer;
+    if (!writer.Open(filename, {{"numCashiers", ColumnarWriter::UINT64_COLUMN},
+                                {"totalCustomers", ColumnarWriter::UINT64_COLUMN},
+                                {"avgWaitingTime", ColumnarWriter::FLOAT64_COLUMN},
+                                {"waitingTimeCiHalfWidth", ColumnarWriter::FLOAT64_COLUMN},
+                                {"ciSamples", ColumnarWriter::UINT64_COLUMN},
+                                {"waitingTimeStdDev", ColumnarWriter::FLOAT64_COLUMN},
+                                {"minWaitingTime", ColumnarWriter::FLOAT64_COLUMN},
+                                {"maxWaitingTime", ColumnarWriter::FLOAT64_COLUMN},
+                                {"utilization", ColumnarWriter::FLOAT64_COLUMN},
+                                {"efficiencyScore", ColumnarWriter::FLOAT64_COLUMN},
+                                {"warmupTime", ColumnarWriter::FLOAT64_COLUMN},
+                                {"waitingTimeP50", ColumnarWriter::FLOAT64_COLUMN},
+                                {"waitingTimeP95", ColumnarWriter::FLOAT64_COLUMN},
+                                {"waitingTimeP99", ColumnarWriter::FLOAT64_COLUMN},
+                                {"avgQueueLength", ColumnarWriter::FLOAT64_COLUMN},
+                                {"avgBusyCashiers", ColumnarWriter::FLOAT64_COLUMN}}))
+    {
+        return false;
+    }
+   
+    for (const auto& result : sortedResults)
+    {
+        writer.Set(0, static_cast<uint64_t>(result.numCashiers));
+        writer.Set(1, static_cast<uint64_t>(result.totalCustomers));
+        writer.Set(2, result.avgWaitingTime);
+        writer.Set(3, result.waitingTimeCiHalfWidth);
+        writer.Set(4, static_cast<uint64_t>(result.ciSamples));
+        writer.Set(5, result.waitingTimeStdDev);
+        writer.Set(6, result.minWaitingTime);
+        writer.Set(7, result.maxWaitingTime);
+        writer.Set(8, result.utilization);
+        writer.Set(9, result.efficiencyScore);
+        writer.Set(10, result.warmupTime);
+        writer.Set(11, result.waitingTimeP50);
+        writer.Set(12, result.waitingTimeP95);
+        writer.Set(13, result.waitingTimeP99);
+        writer.Set(14, result.avgQueueLength);
+        writer.Set(15, result.avgBusyCashiers);
+        writer.EndRow();
+    }
+    log << "Generated columnar results: " << filename << std::endl;
+    return true;
+}
+
+
+// "script" only writes the gnuplot scripts; "png" and "svg" also render them.
+std::string PlotTerminal(const std::string& plotFormat)
+{
+    if (plotFormat == "svg")
+    {
+        return "set terminal svg enhanced font 'Arial,12' size 800,600";
+    }
+    return "set terminal pngcairo enhanced color font 'Arial,12' size 800,600";
+}
+
+
+std::string PlotExtension(const std::string& plotFormat)
+{
+    return (plotFormat == "svg") ? "svg" : "png";
+}
+
+
+bool RenderPlot(const std::string& filename, const std::string& image, const std::string& plotFormat,
+                std::ostream& log)
+{
+    if (plotFormat == "script")
+    {
+        log << "  Run: gnuplot " << filename << " to generate " << image << std::endl;
+        return true;
+    }
+   
+    std::string command = "gnuplot '" + filename + "'";
+    if (std::system(command.c_str()) != 0)
+    {
+        std::cerr << "Error: gnuplot failed on " << filename << std::endl;
+        return false;
+    }
+    log << "  Rendered " << image << std::endl;
+    return true;
+}
+
+
+bool GenerateUtilizationPlot(const std::vector<CashierResults>& sortedResults, const std::string& prefix,
+                             const std::string& plotFormat, std::ostream& log)
+{
+    if (sortedResults.empty())
+    {
+        std::cerr << "No results available for plotting utilization." << std::endl;
+        return false;
+    }
+   
+    std::string filename = prefix + "utilization.plt";
+    std::string dataFile = prefix + "utilization_data.dat";
+    std::string image = prefix + "utilization." + PlotExtension(plotFormat);
+    std::ofstream dataOut(dataFile);
+    if (!dataOut.is_open())
+    {
+        std::cerr << "Error: Could not open data file " << dataFile << " for writing." << std::endl;
+        return false;
+    }
+   
+    dataOut << "# Cashiers Utilization(%)\n";
+    for (const auto& result : sortedResults)
+    {
+        dataOut << result.numCashiers << " "
+                << std::fixed << std::setprecision(2)
+                << result.utilization * 100.0 << "\n";
+    }
+    dataOut.close();
+   
+    std::ofstream pltOut(filename);
+    if (!pltOut.is_open())
+    {
+        std::cerr << "Error: Could not open PLT file " << filename << " for writing." << std::endl;
+        return false;
+    }
+   
+    pltOut << "# GNUplot script for Cashier Utilization\n";
+    pltOut << "# Generated by Supermarket Simulation\n\n";
+    pltOut << PlotTerminal(plotFormat) << "\n";
+    pltOut << "set output '" << image << "'\n\n";
+    pltOut << "# To customize title font size, use: set title 'Title' font 'Arial,16'\n";
+    pltOut << "set title 'Cashier Utilization vs Number of Cashiers'\n";
+    pltOut << "set xlabel 'Number of Cashiers'\n";
+    pltOut << "set ylabel 'Utilization (%)'\n";
+    pltOut << "set grid linestyle 1 linecolor rgb '#cccccc'\n";
+    pltOut << "set key top right\n";
     pltOut << "set xrange [0.5:*]\n";
     pltOut << "set yrange [0:105]\n";
     pltOut << "set xtics 1\n";
@@ -539,74 +5899,1107 @@ void GenerateUtilizationPlot(const std::string& filename = "utilization.plt")
     pltOut << "plot '" << dataFile << "' using 1:2 with linespoints ls 1 title 'Utilization'\n";
     pltOut << "\n# To generate the plot, run: gnuplot " << filename << "\n";
    
-    pltOut.close();
-    std::cout << "Generated utilization plot script: " << filename << std::endl;
-    std::cout << "  Data file: " << dataFile << std::endl;
-    std::cout << "  Run: gnuplot " << filename << " to generate utilization.png" << std::endl;
+    pltOut.close();
+    log << "Generated utilization plot script: " << filename << std::endl;
+    log << "  Data file: " << dataFile << std::endl;
+    return RenderPlot(filename, image, plotFormat, log);
+}
+
+
+bool GenerateWaitingTimePlot(const std::vector<CashierResults>& sortedResults, const std::string& prefix,
+                             const std::string& plotFormat, std::ostream& log)
+{
+    if (sortedResults.empty())
+    {
+        std::cerr << "No results available for plotting waiting time." << std::endl;
+        return false;
+    }
+   
+    std::string filename = prefix + "waiting_time.plt";
+    std::string dataFile = prefix + "waiting_time_data.dat";
+    std::string image = prefix + "waiting_time." + PlotExtension(plotFormat);
+    std::ofstream dataOut(dataFile);
+    if (!dataOut.is_open())
+    {
+        std::cerr << "Error: Could not open data file " << dataFile << " for writing." << std::endl;
+        return false;
+    }
+   
+    dataOut << "# Cashiers AvgWaitingTime(seconds)\n";
+    for (const auto& result : sortedResults)
+    {
+        dataOut << result.numCashiers << " "
+                << std::fixed << std::setprecision(3)
+                << result.avgWaitingTime << "\n";
+    }
+    dataOut.close();
+   
+    std::ofstream pltOut(filename);
+    if (!pltOut.is_open())
+    {
+        std::cerr << "Error: Could not open PLT file " << filename << " for writing." << std::endl;
+        return false;
+    }
+   
+    pltOut << "# GNUplot script for Average Waiting Time\n";
+    pltOut << "# Generated by Supermarket Simulation\n\n";
+    pltOut << PlotTerminal(plotFormat) << "\n";
+    pltOut << "set output '" << image << "'\n\n";
+    pltOut << "# To customize title font size, use: set title 'Title' font 'Arial,16'\n";
+    pltOut << "set title 'Average Waiting Time vs Number of Cashiers'\n";
+    pltOut << "set xlabel 'Number of Cashiers'\n";
+    pltOut << "set ylabel 'Average Waiting Time (seconds)'\n";
+    pltOut << "set grid linestyle 1 linecolor rgb '#cccccc'\n";
+    pltOut << "set key top right\n";
+    pltOut << "set xrange [0.5:*]\n";
+    pltOut << "set yrange [0:*]\n";
+    pltOut << "set xtics 1\n";
+    pltOut << "# Uncomment the next line for logarithmic y-axis (useful for large variations)\n";
+    pltOut << "# set logscale y\n";
+    pltOut << "set style line 1 linecolor rgb '#cc0000' linewidth 2 pointtype 7 pointsize 1.5\n\n";
+    pltOut << "plot '" << dataFile << "' using 1:2 with linespoints ls 1 title 'Average Waiting Time'\n";
+    pltOut << "\n# To generate the plot, run: gnuplot " << filename << "\n";
+   
+    pltOut.close();
+    log << "Generated waiting time plot script: " << filename << std::endl;
+    log << "  Data file: " << dataFile << std::endl;
+    return RenderPlot(filename, image, plotFormat, log);
+}
+
+
+// Writes the plot scripts, their data files and optionally the columnar
+// results on a thread of its own, so reporting overlaps with whatever the
+// caller does next; the thread must not be running across a fork. Submitted
+// results are kept in cashier order as they arrive and every file is
+// written from that one copy after Close.
+// Errors go to std::cerr as they happen; the other messages are held until
+// Wait so they cannot interleave with the caller's output.
+class ReportWriter
+{
+public:
+    ReportWriter();
+    ~ReportWriter();
+   
+    void Start(const std::string& prefix, const std::string& columnarFile, const std::string& plotFormat);
+    void Submit(const CashierResults& results);
+    void Close();
+    bool Wait();
+    std::string GetLog() const;
+    double GetSeconds() const;
+   
+private:
+    void WriteLoop();
+    bool WriteReport();
+   
+    std::string m_prefix;
+    std::string m_columnarFile;
+    std::string m_plotFormat;
+    std::vector<CashierResults> m_submitted;
+    std::vector<CashierResults> m_sorted;
+    std::ostringstream m_log;
+    bool m_closing;
+    bool m_ok;
+    double m_seconds;
+    std::mutex m_mutex;
+    std::condition_variable m_changed;
+    std::thread m_thread;
+};
+
+
+ReportWriter::ReportWriter()
+    : m_closing(false), m_ok(false), m_seconds(0)
+{
+}
+
+
+ReportWriter::~ReportWriter()
+{
+    Wait();
+}
+
+
+// prefix is prepended to every plot and data file name; an empty
+// columnarFile skips the columnar results.
+void ReportWriter::Start(const std::string& prefix, const std::string& columnarFile, const std::string& plotFormat)
+{
+    m_prefix = prefix;
+    m_columnarFile = columnarFile;
+    m_plotFormat = plotFormat;
+    m_closing = false;
+    m_thread = std::thread(&ReportWriter::WriteLoop, this);
+}
+
+
+void ReportWriter::Submit(const CashierResults& results)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_submitted.push_back(results);
+    m_changed.notify_one();
+}
+
+
+void ReportWriter::Close()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_closing = true;
+    m_changed.notify_one();
+}
+
+
+bool ReportWriter::Wait()
+{
+    if (m_thread.joinable())
+    {
+        Close();
+        m_thread.join();
+    }
+    return m_ok;
+}
+
+
+std::string ReportWriter::GetLog() const
+{
+    return m_log.str();
+}
+
+
+double ReportWriter::GetSeconds() const
+{
+    return m_seconds;
+}
+
+
+void ReportWriter::WriteLoop()
+{
+    std::vector<CashierResults> arrived;
+    while (true)
+    {
+        bool closing;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_changed.wait(lock, [this]() { return !m_submitted.empty() || m_closing; });
+            arrived.swap(m_submitted);
+            closing = m_closing;
+        }
+        for (auto& results : arrived)
+        {
+            auto position = std::upper_bound(m_sorted.begin(), m_sorted.end(), results,
+                [](const CashierResults& a, const CashierResults& b) {
+                    return a.numCashiers < b.numCashiers;
+                });
+            m_sorted.insert(position, results);
+        }
+        arrived.clear();
+        if (closing)
+        {
+            auto start = InstrumentationNow();
+            m_ok = WriteReport();
+            m_seconds = std::chrono::duration<double>(InstrumentationNow() - start).count();
+            return;
+        }
+    }
+}
+
+
+bool ReportWriter::WriteReport()
+{
+    bool ok = true;
+    if (!m_columnarFile.empty())
+    {
+        ok = WriteColumnarResults(m_sorted, m_columnarFile, m_log) && ok;
+    }
+    ok = GenerateUtilizationPlot(m_sorted, m_prefix, m_plotFormat, m_log) && ok;
+    ok = GenerateWaitingTimePlot(m_sorted, m_prefix, m_plotFormat, m_log) && ok;
+    return ok;
+}
+
+
+void RecordResults(const CashierResults& results)
+{
+    allResults.push_back(results);
+    if (g_reportWriter != nullptr)
+    {
+        g_reportWriter->Submit(results);
+    }
+}
+
+
+struct StoreScenario
+{
+    std::string name;
+    SweepParameters params;
+};
+
+
+// Per-store results as sent back by a store worker; fixed size so they can
+// go through a pipe as raw bytes.
+struct StoreResults
+{
+    char name[64];
+    uint32_t recommendedCashiers;
+    uint32_t simulations;
+    CashierResults best;
+};
+
+
+bool ValidateParameters(const SweepParameters& params)
+{
+    if (params.arrivalRate <= 0 || params.serviceRate <= 0 || params.maxCashiers == 0 || params.simulationTime <= 0)
+    {
+        std::cerr << "Error: Rates, maxCashiers and simulationTime must be positive" << std::endl;
+        return false;
+    }
+    if (params.warmupTime < 0 || params.warmupTime >= params.simulationTime || params.warmupPilotTime < 0 ||
+        params.warmupPilotTime > params.simulationTime)
+    {
+        std::cerr << "Error: warmupTime must be below simulationTime and warmupPilotTime within it" << std::endl;
+        return false;
+    }
+    bool laneQueues;
+    LaneRouting routing;
+    if (CreateIdleCashierPool(params.cashierSelection) == nullptr || CreateEventEngine(params.engine) == nullptr ||
+        (params.randomSource != "ns3" && params.randomSource != "fast") ||
+        (params.search != "none" && params.search != "bisection" && params.search != "analytic") ||
+        !ParseTopology(params.topology, params.routing, laneQueues, routing))
+    {
+        std::cerr << "Error: Unknown selection, engine, rng, search, topology or routing" << std::endl;
+        return false;
+    }
+    if (params.staffingPlan && params.staffingPlan->GetMaxCashiers() > params.maxCashiers)
+    {
+        std::cerr << "Error: Staffing plan opens " << params.staffingPlan->GetMaxCashiers()
+                  << " lanes but maxCashiers is " << params.maxCashiers << std::endl;
+        return false;
+    }
+    bool staffed = (params.staffingPlan || params.openAbove > 0);
+    if (params.topology == "lanes" && staffed)
+    {
+        std::cerr << "Error: Dynamic staffing needs the pooled topology" << std::endl;
+        return false;
+    }
+    if (params.replayTrace && (params.traceSweep || params.arrivalSchedule || params.replications > 1))
+    {
+        std::cerr << "Error: replayTrace replaces the random arrivals and cannot be combined with "
+                  << "traceSweep, arrivalSchedule or replications (every replication would be identical)"
+                  << std::endl;
+        return false;
+    }
+    if (params.replayTrace && (!IsExponential(params.arrivalSpec, params.serviceSpec) ||
+                               params.search == "analytic" || params.analyticPrune))
+    {
+        std::cerr << "Error: replayTrace supplies the interarrival and service times, so it cannot be combined "
+                  << "with arrival or service distributions, search=analytic or analyticPrune" << std::endl;
+        return false;
+    }
+    if (params.traceSweep && (staffed || params.topology != "pooled" || params.search != "none" ||
+                              params.replications > 1 || params.batches > 0 || params.autoWarmup))
+    {
+        std::cerr << "Error: traceSweep supports one pooled run per cashier count without staffing, search, "
+                  << "replications, batches or autoWarmup" << std::endl;
+        return false;
+    }
+    if (!params.checkpoint.empty() &&
+        (params.engine != "calendar" || params.topology != "pooled" || params.replications > 1 ||
+         params.customerTrace || params.traceSweep || params.checkpointInterval <= 0))
+    {
+        std::cerr << "Error: checkpoint needs engine=calendar, the pooled topology, one replication, no customerTrace "
+                  << "or traceSweep, and a positive checkpointInterval" << std::endl;
+        return false;
+    }
+    bool classed = (params.priorityShare > 0 || params.balkAbove > 0 || params.meanPatience > 0);
+    if (classed && (params.topology != "pooled" || !params.checkpoint.empty() || params.traceSweep ||
+                    params.priorityShare > 1 || params.meanPatience < 0))
+    {
+        std::cerr << "Error: Customer classes need the pooled topology, priorityShare within [0, 1], and no "
+                  << "checkpoint or traceSweep" << std::endl;
+        return false;
+    }
+    if (!IsExponential(params.arrivalSpec, params.serviceSpec) && (params.search == "analytic" || params.analyticPrune))
+    {
+        std::cerr << "Error: The analytic search and pruning use Erlang-C, which needs exponential distributions"
+                  << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
+// One store per line: "name,arrivalRate,serviceRate,maxCashiers" with an
+// optional fifth field naming an arrival schedule. Everything else comes
+// from the command line defaults. Per-configuration files would collide
+// between stores, so raw samples and traces are not written.
+bool LoadStoreScenarios(const std::string& filename, const SweepParameters& defaults,
+                        std::vector<StoreScenario>& stores)
+{
+    std::ifstream in(filename);
+    if (!in.is_open())
+    {
+        std::cerr << "Error: Could not open store file " << filename << std::endl;
+        return false;
+    }
+   
+    std::string line;
+    while (std::getline(in, line))
+    {
+        if (line.empty() || line[0] == '#')
+        {
+            continue;
+        }
+        std::replace(line.begin(), line.end(), ',', ' ');
+        std::istringstream fields(line);
+        StoreScenario store;
+        store.params = defaults;
+        std::string schedule;
+        if (!(fields >> store.name >> store.params.arrivalRate >> store.params.serviceRate
+                     >> store.params.maxCashiers) ||
+            store.name.size() >= sizeof(StoreResults().name) || store.params.arrivalRate <= 0 ||
+            store.params.serviceRate <= 0 || store.params.maxCashiers == 0)
+        {
+            std::cerr << "Error: Bad store line in " << filename << ": " << line << std::endl;
+            return false;
+        }
+        if (fields >> schedule)
+        {
+            std::shared_ptr<ArrivalRateSchedule> rates = std::make_shared<ArrivalRateSchedule>();
+            if (!rates->Load(schedule))
+            {
+                return false;
+            }
+            store.params.arrivalSchedule = rates;
+        }
+        store.params.keepRawSamples = false;
+        store.params.customerTrace = false;
+        if (!ValidateParameters(store.params))
+        {
+            return false;
+        }
+        stores.push_back(store);
+    }
+    return true;
+}
+
+
+// Sizes one store with the configured search, or a sweep and
+// FindOptimalCashiers without one. Store k uses runs from
+// baseRun + k * replications, so no two stores share a substream. A
+// report, when given, receives the store's results and is closed on
+// return, leaving it to finish while the caller moves on.
+StoreResults RunStore(const StoreScenario& store, uint32_t storeIndex, uint64_t baseRun,
+                      ReportWriter* report)
+{
+    const SweepParameters& params = store.params;
+    RngSeedManager::SetRun(baseRun + static_cast<uint64_t>(storeIndex) * params.replications);
+    allResults.clear();
+    g_reportWriter = report;
+   
+    StoreResults results;
+    std::memset(&results, 0, sizeof(results));
+    std::strncpy(results.name, store.name.c_str(), sizeof(results.name) - 1);
+   
+    std::ostringstream discarded;
+    if (params.search != "none")
+    {
+        CashierSearch cashierSearch(params, discarded);
+        results.recommendedCashiers = cashierSearch.Run();
+        results.simulations = cashierSearch.GetSimulations();
+    }
+    else
+    {
+        std::vector<uint32_t> configurations = SelectSweepConfigurations(params);
+        for (uint32_t numCashiers : configurations)
+        {
+            RunCashierConfiguration(numCashiers, params, discarded);
+        }
+        results.recommendedCashiers = FindOptimalCashiers();
+        results.simulations = configurations.size();
+    }
+   
+    for (auto& result : allResults)
+    {
+        if (result.numCashiers == results.recommendedCashiers)
+        {
+            results.best = result;
+        }
+    }
+    g_reportWriter = nullptr;
+    if (report != nullptr)
+    {
+        report->Close();
+    }
+    RngSeedManager::SetRun(baseRun);
+    return results;
+}
+
+
+std::unique_ptr<ReportWriter> StartStoreReport(const StoreScenario& store)
+{
+    if (!store.params.storeReports)
+    {
+        return nullptr;
+    }
+    std::unique_ptr<ReportWriter> report(new ReportWriter());
+    report->Start(store.name + "_", "", store.params.plotFormat);
+    return report;
+}
+
+
+// Reports only show up as files, so a failed one is named here.
+void FinishStoreReport(std::unique_ptr<ReportWriter>& report, const StoreScenario& store)
+{
+    if (report && !report->Wait())
+    {
+        NS_LOG_ERROR("Report for store " << store.name << " is incomplete");
+    }
+    report.reset();
+}
+
+
+// Runs the given stores on a pool of forked workers and returns their
+// results in the order given. With commonRuns every store draws from the
+// first store's runs, so grid points see common random numbers.
+std::vector<StoreResults> RunStores(const std::vector<StoreScenario>& stores, const std::vector<uint32_t>& assigned,
+                                    uint32_t workers, bool commonRuns)
+{
+    uint64_t baseRun = RngSeedManager::GetRun();
+    std::vector<StoreResults> results;
+    if (workers <= 1)
+    {
+        // Each store's report is written while the next store simulates.
+        std::unique_ptr<ReportWriter> previous;
+        uint32_t previousIndex = 0;
+        for (uint32_t index : assigned)
+        {
+            std::unique_ptr<ReportWriter> report = StartStoreReport(stores[index]);
+            results.push_back(RunStore(stores[index], commonRuns ? 0 : index, baseRun, report.get()));
+            FinishStoreReport(previous, stores[previousIndex]);
+            previous = std::move(report);
+            previousIndex = index;
+        }
+        FinishStoreReport(previous, stores[previousIndex]);
+        return results;
+    }
+   
+    std::deque<SweepWorker> running;
+    size_t next = 0;
+    while (next < assigned.size() || !running.empty())
+    {
+        while (next < assigned.size() && running.size() < workers)
+        {
+            uint32_t index = assigned[next];
+            running.push_back(StartWorker(index, [&stores, index, baseRun, commonRuns]() {
+                std::unique_ptr<ReportWriter> report = StartStoreReport(stores[index]);
+                StoreResults store = RunStore(stores[index], commonRuns ? 0 : index, baseRun, report.get());
+                FinishStoreReport(report, stores[index]);
+                return std::string(reinterpret_cast<const char*>(&store), sizeof(store));
+            }));
+            next++;
+        }
+       
+        SweepWorker worker = running.front();
+        running.pop_front();
+        std::string payload;
+        StoreResults store;
+        if (FinishWorker(worker, payload) && payload.size() == sizeof(store))
+        {
+            std::memcpy(&store, payload.data(), sizeof(store));
+        }
+        else
+        {
+            NS_LOG_ERROR("Store worker for " << stores[worker.id].name << " failed, running it in-process");
+            std::unique_ptr<ReportWriter> report = StartStoreReport(stores[worker.id]);
+            store = RunStore(stores[worker.id], commonRuns ? 0 : worker.id, baseRun, report.get());
+            FinishStoreReport(report, stores[worker.id]);
+        }
+        results.push_back(store);
+    }
+    return results;
+}
+
+
+void PrintStoreResults(const std::vector<StoreResults>& results, std::ostream& os)
+{
+    os << "Store                | Cashiers | Avg Wait Time | Utilization | Simulations" << std::endl;
+    os << "---------------------|----------|---------------|-------------|------------" << std::endl;
+    for (auto& store : results)
+    {
+        os << std::left << std::setw(20) << store.name << std::right << " | "
+           << std::setw(8) << store.recommendedCashiers << " | "
+           << std::setw(13) << std::fixed << std::setprecision(2) << store.best.avgWaitingTime << " | "
+           << std::setw(10) << std::fixed << std::setprecision(1) << store.best.utilization * 100 << "% | "
+           << std::setw(11) << store.simulations << std::endl;
+    }
+}
+
+
+bool WriteStoreResults(const std::vector<StoreResults>& results, const std::string& filename)
+{
+    std::ofstream out(filename);
+    if (!out.is_open())
+    {
+        std::cerr << "Error: Could not open " << filename << " for writing." << std::endl;
+        return false;
+    }
+   
+    out << "# Store Cashiers AvgWait(s) Utilization Simulations\n";
+    for (auto& store : results)
+    {
+        out << store.name << " " << store.recommendedCashiers << " " << std::fixed << std::setprecision(6)
+            << store.best.avgWaitingTime << " " << store.best.utilization << " " << store.simulations << "\n";
+    }
+    return true;
+}
+
+
+// Runs this rank's share of the stores (every numRanks-th, starting at
+// rank), so ranks can be spread over nodes by any launcher and their result
+// files concatenated afterwards.
+int RunStoreBatch(const std::vector<StoreScenario>& stores, uint32_t workers, uint32_t rank, uint32_t numRanks)
+{
+    std::vector<uint32_t> assigned;
+    for (uint32_t i = rank; i < stores.size(); i += numRanks)
+    {
+        assigned.push_back(i);
+    }
+    std::cout << "Store batch: " << assigned.size() << " of " << stores.size() << " stores on rank "
+              << rank << " of " << numRanks << ", " << workers << " workers" << std::endl;
+   
+    std::vector<StoreResults> results = RunStores(stores, assigned, workers, false);
+   
+    std::ostringstream filename;
+    filename << "store_results";
+    if (numRanks > 1)
+    {
+        filename << "_rank" << rank;
+    }
+    filename << ".dat";
+   
+    std::cout << "\n Store Results " << std::endl;
+    PrintStoreResults(results, std::cout);
+    if (!WriteStoreResults(results, filename.str()))
+    {
+        return 1;
+    }
+    std::cout << "Results written to " << filename.str() << std::endl;
+    return 0;
+}
+
+
+// One [[experiment]] table of an experiment file. A setting whose value is
+// an array is a grid axis; the experiment runs every combination.
+struct ExperimentSpec
+{
+    std::string name;
+    std::string output;
+    std::vector<std::pair<std::string, std::vector<std::string>>> settings;
+};
+
+
+bool ParseExperimentValue(const std::string& text, std::vector<std::string>& values)
+{
+    size_t first = text.find_first_not_of(" \t");
+    if (first == std::string::npos)
+    {
+        return false;
+    }
+    std::string value = text.substr(first);
+    bool isArray = (!value.empty() && value[0] == '[');
+    if (isArray)
+    {
+        if (value.back() != ']')
+        {
+            return false;
+        }
+        value = value.substr(1, value.size() - 2);
+    }
+   
+    std::istringstream items(value);
+    std::string item;
+    while (std::getline(items, item, isArray ? ',' : '\n'))
+    {
+        first = item.find_first_not_of(" \t");
+        if (first == std::string::npos)
+        {
+            continue;
+        }
+        item = item.substr(first, item.find_last_not_of(" \t") - first + 1);
+        if (item.size() >= 2 && item.front() == '"' && item.back() == '"')
+        {
+            item = item.substr(1, item.size() - 2);
+        }
+        values.push_back(item);
+    }
+    return !values.empty();
+}
+
+
+// Reads the TOML subset experiments are written in: a [defaults] table and
+// any number of [[experiment]] tables holding key = value lines, where a
+// value is a number, a "string", true/false or a one-line [array].
+bool LoadExperimentFile(const std::string& filename, ExperimentSpec& defaults, std::vector<ExperimentSpec>& experiments)
+{
+    std::ifstream in(filename);
+    if (!in.is_open())
+    {
+        std::cerr << "Error: Could not open experiment file " << filename << std::endl;
+        return false;
+    }
+   
+    ExperimentSpec* table = nullptr;
+    std::string line;
+    uint32_t lineNumber = 0;
+    while (std::getline(in, line))
+    {
+        lineNumber++;
+        bool quoted = false;
+        for (size_t i = 0; i < line.size(); i++)
+        {
+            quoted ^= (line[i] == '"');
+            if (line[i] == '#' && !quoted)
+            {
+                line.erase(i);
+                break;
+            }
+        }
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos)
+        {
+            continue;
+        }
+        line = line.substr(first, line.find_last_not_of(" \t\r") - first + 1);
+       
+        if (line == "[defaults]")
+        {
+            table = &defaults;
+            continue;
+        }
+        if (line == "[[experiment]]")
+        {
+            experiments.push_back(ExperimentSpec());
+            table = &experiments.back();
+            std::ostringstream name;
+            name << "experiment" << experiments.size();
+            table->name = name.str();
+            continue;
+        }
+       
+        size_t equals = line.find('=');
+        std::vector<std::string> values;
+        if (table == nullptr || equals == std::string::npos ||
+            !ParseExperimentValue(line.substr(equals + 1), values))
+        {
+            std::cerr << "Error: " << filename << ":" << lineNumber << ": cannot parse '" << line << "'" << std::endl;
+            return false;
+        }
+        std::string key = line.substr(0, line.find_last_not_of(" \t", equals - 1) + 1);
+        if (key == "name")
+        {
+            table->name = values[0];
+        }
+        else if (key == "output")
+        {
+            table->output = values[0];
+        }
+        else
+        {
+            table->settings.push_back(std::make_pair(key, values));
+        }
+    }
+    return true;
+}
+
+
+// Parses all of value, so "4abc" is rejected rather than read as 4.
+template <typename T>
+bool ParseWholeValue(const std::string& value, T& parsed)
+{
+    std::istringstream text(value);
+    T result;
+    if (!(text >> result) || !(text >> std::ws).eof())
+    {
+        return false;
+    }
+    parsed = result;
+    return true;
+}
+
+
+// Sets one parameter from its text form, as an experiment file gives it.
+// Every numeric setting is non-negative.
+bool ApplyParameter(SweepParameters& params, const std::string& key, const std::string& value)
+{
+    std::map<std::string, uint32_t*> counts = {
+        {"maxCashiers", &params.maxCashiers}, {"replications", &params.replications},
+        {"batches", &params.batches}, {"minSamples", &params.minSamples},
+        {"expressLanes", &params.expressLanes}, {"expressItems", &params.expressItems},
+        {"balkAbove", &params.balkAbove}};
+    std::map<std::string, double*> reals = {
+        {"arrivalRate", &params.arrivalRate}, {"serviceRate", &params.serviceRate},
+        {"simulationTime", &params.simulationTime}, {"ciHalfWidth", &params.ciHalfWidth},
+        {"warmupTime", &params.warmupTime}, {"targetWait", &params.targetWait}, {"meanItems", &params.meanItems},
+        {"priorityShare", &params.priorityShare}, {"meanPatience", &params.meanPatience}};
+    std::map<std::string, bool*> flags = {
+        {"autoWarmup", &params.autoWarmup}, {"crn", &params.commonRandomNumbers},
+        {"analyticPrune", &params.analyticPrune}};
+    std::map<std::string, std::string*> names = {
+        {"search", &params.search}, {"engine", &params.engine}, {"rng", &params.randomSource},
+        {"cashierSelection", &params.cashierSelection}, {"topology", &params.topology},
+        {"routing", &params.routing}};
+   
+    bool ok = true;
+    if (counts.count(key))
+    {
+        ok = (value.find('-') == std::string::npos) && ParseWholeValue(value, *counts[key]);
+    }
+    else if (reals.count(key))
+    {
+        ok = ParseWholeValue(value, *reals[key]) && *reals[key] >= 0;
+    }
+    else if (flags.count(key))
+    {
+        ok = (value == "true" || value == "false");
+        *flags[key] = (value == "true");
+    }
+    else if (names.count(key))
+    {
+        *names[key] = value;
+    }
+    else if (key == "arrivalDistribution")
+    {
+        params.arrivalDistribution = value;
+        params.arrivalSpec = ParseDistribution(value);
+        ok = (params.arrivalSpec != nullptr);
+    }
+    else if (key == "serviceDistribution")
+    {
+        params.serviceDistribution = value;
+        params.serviceSpec = ParseDistribution(value);
+        ok = (params.serviceSpec != nullptr);
+    }
+    else if (key == "arrivalSchedule")
+    {
+        std::shared_ptr<ArrivalRateSchedule> schedule = std::make_shared<ArrivalRateSchedule>();
+        ok = schedule->Load(value);
+        params.arrivalSchedule = schedule;
+    }
+    else
+    {
+        std::cerr << "Error: Unknown experiment setting '" << key << "'" << std::endl;
+        return false;
+    }
+   
+    if (!ok)
+    {
+        std::cerr << "Error: Bad value '" << value << "' for " << key << std::endl;
+    }
+    return ok;
+}
+
+
+// Expands an experiment's grid into one scenario per combination, named
+// after the grid values, e.g. "peak[arrivalRate=4,crn=true]".
+bool ExpandExperiment(const ExperimentSpec& experiment, const SweepParameters& defaults,
+                      std::vector<StoreScenario>& scenarios)
+{
+    std::vector<size_t> choice(experiment.settings.size(), 0);
+    while (true)
+    {
+        StoreScenario scenario;
+        scenario.params = defaults;
+        std::string grid;
+        for (size_t i = 0; i < experiment.settings.size(); i++)
+        {
+            const std::string& key = experiment.settings[i].first;
+            const std::vector<std::string>& values = experiment.settings[i].second;
+            if (!ApplyParameter(scenario.params, key, values[choice[i]]))
+            {
+                return false;
+            }
+            if (values.size() > 1)
+            {
+                grid += (grid.empty() ? "" : ",") + key + "=" + values[choice[i]];
+            }
+        }
+        scenario.params.replications = std::max<uint32_t>(scenario.params.replications, 1);
+        if (!ValidateParameters(scenario.params))
+        {
+            return false;
+        }
+        scenario.name = grid.empty() ? experiment.name : experiment.name + "[" + grid + "]";
+        if (scenario.name.size() >= sizeof(StoreResults().name))
+        {
+            scenario.name.resize(sizeof(StoreResults().name) - 1);
+        }
+        scenarios.push_back(scenario);
+       
+        size_t axis = 0;
+        while (axis < choice.size() && ++choice[axis] == experiment.settings[axis].second.size())
+        {
+            choice[axis] = 0;
+            axis++;
+        }
+        if (axis == choice.size())
+        {
+            return true;
+        }
+    }
 }
 
 
-void GenerateWaitingTimePlot(const std::string& filename = "waiting_time.plt")
+// Runs every experiment of the file in this process, one after another, with
+// [defaults] applied over the command line values. Each experiment prints
+// its table and, with output = "file", also writes it.
+int RunExperimentFile(const std::string& filename, const SweepParameters& cliParams, uint32_t workers)
 {
-    if (allResults.empty())
+    ExperimentSpec defaultSpec;
+    std::vector<ExperimentSpec> experiments;
+    if (!LoadExperimentFile(filename, defaultSpec, experiments))
     {
-        std::cerr << "No results available for plotting waiting time." << std::endl;
-        return;
+        return 1;
     }
    
-    std::vector<CashierResults> sortedResults = allResults;
-    std::sort(sortedResults.begin(), sortedResults.end(),
-        [](const CashierResults& a, const CashierResults& b) {
-            return a.numCashiers < b.numCashiers;
-        });
+    SweepParameters defaults = cliParams;
+    for (auto& setting : defaultSpec.settings)
+    {
+        if (!ApplyParameter(defaults, setting.first, setting.second[0]))
+        {
+            return 1;
+        }
+    }
+    defaults.keepRawSamples = false;
+    defaults.customerTrace = false;
    
-    std::string dataFile = "waiting_time_data.dat";
-    std::ofstream dataOut(dataFile);
-    if (!dataOut.is_open())
+    for (auto& experiment : experiments)
     {
-        std::cerr << "Error: Could not open data file " << dataFile << " for writing." << std::endl;
-        return;
+        std::vector<StoreScenario> scenarios;
+        if (!ExpandExperiment(experiment, defaults, scenarios))
+        {
+            std::cerr << "Error: Experiment " << experiment.name << " is invalid" << std::endl;
+            return 1;
+        }
+       
+        std::vector<uint32_t> assigned;
+        for (uint32_t i = 0; i < scenarios.size(); i++)
+        {
+            assigned.push_back(i);
+        }
+        std::vector<StoreResults> results = RunStores(scenarios, assigned, workers, true);
+       
+        std::cout << "\n Experiment " << experiment.name << " (" << scenarios.size() << " runs) " << std::endl;
+        PrintStoreResults(results, std::cout);
+        if (!experiment.output.empty())
+        {
+            if (!WriteStoreResults(results, experiment.output))
+            {
+                return 1;
+            }
+            std::cout << "Results written to " << experiment.output << std::endl;
+        }
+    }
+    return 0;
+}
+
+
+struct BenchmarkResults
+{
+    uint32_t numCashiers;
+    double load;
+    uint64_t customers;
+    uint64_t events;
+    double wallSeconds;
+    double nsPerArrival;
+    double nsPerCompletion;
+    long peakRssKb;
+    uint64_t allocations;
+};
+
+
+bool ParseNumberList(const std::string& text, std::vector<double>& values)
+{
+    std::vector<std::string> items;
+    if (!ParseExperimentValue("[" + text + "]", items))
+    {
+        return false;
+    }
+    for (auto& item : items)
+    {
+        std::istringstream number(item);
+        double value;
+        if (!(number >> value) || value <= 0)
+        {
+            std::cerr << "Error: Bad number '" << item << "' in list '" << text << "'" << std::endl;
+            return false;
+        }
+        values.push_back(value);
     }
+    return true;
+}
+
+
+// One single-run case at utilization load. The run is repeated with every
+// event timed, since timing events individually slows the run it measures.
+BenchmarkResults RunSingleBenchmark(uint32_t numCashiers, double load, uint64_t customers,
+                                    const SweepParameters& base)
+{
+    SweepParameters params = base;
+    params.arrivalRate = load * numCashiers * params.serviceRate;
+    params.simulationTime = customers / params.arrivalRate;
    
-    dataOut << "# Cashiers AvgWaitingTime(seconds)\n";
-    for (const auto& result : sortedResults)
+    BenchmarkResults results;
+    std::memset(&results, 0, sizeof(results));
+    results.numCashiers = numCashiers;
+    results.load = load;
+   
+    uint64_t allocationsBefore = g_allocations.load();
+    auto start = std::chrono::steady_clock::now();
     {
-        dataOut << result.numCashiers << " "
-                << std::fixed << std::setprecision(3)
-                << result.avgWaitingTime << "\n";
+        SupermarketSimulation sim(numCashiers, params.arrivalRate, params.serviceRate);
+        ConfigureRandomNumbers(sim, numCashiers, params);
+        sim.SetCashierSelection(params.cashierSelection);
+        sim.RunSimulation(params.simulationTime);
+        results.customers = sim.GetArrivalCount();
+        results.events = sim.GetEventCount();
+        Simulator::Destroy();
     }
-    dataOut.close();
+    results.wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    results.allocations = g_allocations.load() - allocationsBefore;
    
-    std::ofstream pltOut(filename);
-    if (!pltOut.is_open())
+    SupermarketSimulation timed(numCashiers, params.arrivalRate, params.serviceRate);
+    ConfigureRandomNumbers(timed, numCashiers, params);
+    timed.SetCashierSelection(params.cashierSelection);
+    timed.SetEventTiming(true);
+    timed.RunSimulation(params.simulationTime);
+    results.nsPerArrival = timed.GetNanosecondsPerArrival();
+    results.nsPerCompletion = timed.GetNanosecondsPerCompletion();
+    Simulator::Destroy();
+    return results;
+}
+
+
+// The full sweep over 1..maxCashiers as main runs it, with the report discarded.
+BenchmarkResults RunSweepBenchmark(const SweepParameters& params)
+{
+    BenchmarkResults results;
+    std::memset(&results, 0, sizeof(results));
+    results.numCashiers = params.maxCashiers;
+   
+    uint64_t allocationsBefore = g_allocations.load();
+    uint64_t eventsBefore = g_events.load();
+    auto start = std::chrono::steady_clock::now();
+    allResults.clear();
+    std::ostringstream discarded;
+    for (uint32_t numCashiers : SelectSweepConfigurations(params))
     {
-        std::cerr << "Error: Could not open PLT file " << filename << " for writing." << std::endl;
-        return;
+        RunCashierConfiguration(numCashiers, params, discarded);
+    }
+    results.wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    results.allocations = g_allocations.load() - allocationsBefore;
+    results.events = g_events.load() - eventsBefore;
+    for (auto& result : allResults)
+    {
+        results.customers += result.totalCustomers;
+    }
+    return results;
+}
+
+
+// Each case runs alone in a forked worker, so its peak RSS is its own.
+bool RunBenchmarkCase(const std::function<BenchmarkResults()>& benchmark, BenchmarkResults& results)
+{
+    std::string payload;
+    SweepWorker worker = StartWorker(0, [&benchmark]() {
+        BenchmarkResults measured = benchmark();
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        measured.peakRssKb = usage.ru_maxrss;
+        return std::string(reinterpret_cast<const char*>(&measured), sizeof(measured));
+    });
+    if (!FinishWorker(worker, payload) || payload.size() != sizeof(results))
+    {
+        return false;
+    }
+    std::memcpy(&results, payload.data(), sizeof(results));
+    return true;
+}
+
+
+// Writes one CSV row per case to stdout and to filename: single runs for
+// every engine, cashier count and load, then a full sweep per engine.
+int RunBenchmarks(const SweepParameters& base, const std::string& engines, const std::string& cashiers,
+                  const std::string& loads, uint64_t customers, const std::string& filename)
+{
+    std::vector<std::string> engineList;
+    std::vector<double> cashierList;
+    std::vector<double> loadList;
+    if (!ParseExperimentValue("[" + engines + "]", engineList) || !ParseNumberList(cashiers, cashierList) ||
+        !ParseNumberList(loads, loadList))
+    {
+        return 1;
+    }
+    for (auto& engine : engineList)
+    {
+        if (CreateEventEngine(engine) == nullptr)
+        {
+            std::cerr << "Error: Unknown event engine '" << engine << "'" << std::endl;
+            return 1;
+        }
     }
    
-    pltOut << "# GNUplot script for Average Waiting Time\n";
-    pltOut << "# Generated by Supermarket Simulation\n\n";
-    pltOut << "set terminal pngcairo enhanced color font 'Arial,12' size 800,600\n";
-    pltOut << "set output 'waiting_time.png'\n\n";
-    pltOut << "# To customize title font size, use: set title 'Title' font 'Arial,16'\n";
-    pltOut << "set title 'Average Waiting Time vs Number of Cashiers'\n";
-    pltOut << "set xlabel 'Number of Cashiers'\n";
-    pltOut << "set ylabel 'Average Waiting Time (seconds)'\n";
-    pltOut << "set grid linestyle 1 linecolor rgb '#cccccc'\n";
-    pltOut << "set key top right\n";
-    pltOut << "set xrange [0.5:*]\n";
-    pltOut << "set yrange [0:*]\n";
-    pltOut << "set xtics 1\n";
-    pltOut << "# Uncomment the next line for logarithmic y-axis (useful for large variations)\n";
-    pltOut << "# set logscale y\n";
-    pltOut << "set style line 1 linecolor rgb '#cc0000' linewidth 2 pointtype 7 pointsize 1.5\n\n";
-    pltOut << "plot '" << dataFile << "' using 1:2 with linespoints ls 1 title 'Average Waiting Time'\n";
-    pltOut << "\n# To generate the plot, run: gnuplot " << filename << "\n";
+    std::ofstream out(filename);
+    if (!out.is_open())
+    {
+        std::cerr << "Error: Could not open " << filename << " for writing." << std::endl;
+        return 1;
+    }
+    std::string header = "kind,engine,rng,cashiers,load,customers,events,wall_s,events_per_s,ns_per_event,"
+                         "ns_per_arrival,ns_per_completion,peak_rss_kb,allocs_per_customer";
+    std::cout << header << std::endl;
+    out << header << "\n";
    
-    pltOut.close();
-    std::cout << "Generated waiting time plot script: " << filename << std::endl;
-    std::cout << "  Data file: " << dataFile << std::endl;
-    std::cout << "  Run: gnuplot " << filename << " to generate waiting_time.png" << std::endl;
+    for (auto& engine : engineList)
+    {
+        SweepParameters params = base;
+        params.engine = engine;
+        params.keepRawSamples = false;
+        params.customerTrace = false;
+       
+        std::vector<std::pair<std::string, std::function<BenchmarkResults()>>> cases;
+        for (double c : cashierList)
+        {
+            for (double load : loadList)
+            {
+                uint32_t numCashiers = static_cast<uint32_t>(c);
+                cases.push_back(std::make_pair("single", [numCashiers, load, customers, params]() {
+                    return RunSingleBenchmark(numCashiers, load, customers, params);
+                }));
+            }
+        }
+        cases.push_back(std::make_pair("sweep", [params]() { return RunSweepBenchmark(params); }));
+       
+        for (auto& benchmark : cases)
+        {
+            BenchmarkResults results;
+            if (!RunBenchmarkCase(benchmark.second, results))
+            {
+                NS_LOG_ERROR("Benchmark case failed on engine " << engine);
+                return 1;
+            }
+            std::ostringstream row;
+            row << benchmark.first << "," << engine << "," << params.randomSource << "," << results.numCashiers << ","
+                << results.load << "," << results.customers << "," << results.events << ","
+                << std::fixed << std::setprecision(6) << results.wallSeconds << "," << std::setprecision(0)
+                << ((results.wallSeconds > 0) ? results.events / results.wallSeconds : 0) << ","
+                << std::setprecision(1) << ((results.events > 0) ? results.wallSeconds * 1e9 / results.events : 0)
+                << "," << results.nsPerArrival << "," << results.nsPerCompletion << "," << results.peakRssKb << ","
+                << std::setprecision(3);
+            if (ALLOCATION_COUNTING)
+            {
+                row << ((results.customers > 0) ? static_cast<double>(results.allocations) / results.customers : 0);
+            }
+            std::cout << row.str() << std::endl;
+            out << row.str() << "\n";
+        }
+    }
+    return 0;
 }
 
 
@@ -617,53 +7010,474 @@ int main(int argc, char *argv[])
     double arrivalRate = 2.0;  // customers per second
     double serviceRate = 1.0;  // customers per second
     double simulationTime = 1000.0;  // seconds
+    uint32_t workers = 1;  // 0 = one per online core
+    bool keepRawSamples = false;
+    bool customerTrace = false;
+    std::string cashierSelection = "lowest";
+    bool analyticPrune = false;
+    double pruneMargin = 0.10;
+    bool validateAnalytic = false;
+    uint32_t replications = 1;
+    uint32_t batches = 0;
+    uint32_t minSamples = 5;
+    double ciHalfWidth = 0;
+    double warmupTime = 0;
+    bool autoWarmup = false;
+    double warmupPilotTime = 0;  // 0 = a quarter of simulationTime
+    std::string search = "none";
+    double targetWait = 0;  // seconds, 0 = utilization band
+    bool commonRandomNumbers = false;
+    std::string engine = "ns3";
+    std::string randomSource = "ns3";
+    std::string arrivalDistribution = "exponential";
+    std::string serviceDistribution = "exponential";
+    std::string arrivalSchedule = "";
+    std::string staffingPlan = "";
+    uint32_t openAbove = 0;  // 0 = no reactive lanes
+    std::string topology = "pooled";
+    std::string routing = "jsq";
+    uint32_t expressLanes = 0;
+    uint32_t expressItems = 10;
+    double meanItems = 20;
+    std::string storesFile = "";
+    uint32_t rank = 0;
+    uint32_t numRanks = 1;
+    std::string experimentFile = "";
+    bool columnarOutput = false;
+    uint32_t traceSampleEvery = 1;
+    std::string traceCompression = "none";
+    bool perCashierStats = false;
+    bool traceSweep = false;
+    std::string replayTrace = "";
+    std::string recordTrace = "";
+    std::string checkpoint = "";
+    double checkpointInterval = 300;
+    bool resume = false;
+    double branchAt = 0;
+    double priorityShare = 0;
+    uint32_t balkAbove = 0;
+    double meanPatience = 0;
+    std::string branchPlans = "";
+    std::string plotFormat = "script";
+    bool storeReports = false;
+    bool benchmark = false;
+    std::string benchmarkEngines = "ns3,calendar";
+    std::string benchmarkCashiers = "1,10,100,1000,2000";
+    std::string benchmarkLoads = "0.5,0.8,0.95,0.99";
+    uint64_t benchmarkCustomers = 200000;
+    std::string benchmarkOutput = "benchmark.csv";
    
     CommandLine cmd;
     cmd.AddValue("maxCashiers", "Maximum number of cashiers to test", maxCashiers);
     cmd.AddValue("arrivalRate", "Customer arrival rate (customers/second)", arrivalRate);
     cmd.AddValue("serviceRate", "Service rate per cashier (customers/second)", serviceRate);
     cmd.AddValue("simulationTime", "Simulation time in seconds", simulationTime);
+    cmd.AddValue("workers", "Worker processes for the cashier sweep (1 = serial, 0 = all cores)", workers);
+    cmd.AddValue("keepRawSamples", "Also write every waiting time to waiting_times_<cashiers>.dat", keepRawSamples);
+    cmd.AddValue("customerTrace", "Stream every served customer to customer_trace_<cashiers>.dat", customerTrace);
+    cmd.AddValue("cashierSelection", "Idle cashier chosen for an arrival: lowest, longest-idle or most-recent", cashierSelection);
+    cmd.AddValue("analyticPrune", "Only simulate cashier counts near the target utilization band (Erlang-C)", analyticPrune);
+    cmd.AddValue("pruneMargin", "Utilization margin around the band kept by analyticPrune", pruneMargin);
+    cmd.AddValue("validateAnalytic", "Compare simulated results with Erlang-C after the sweep", validateAnalytic);
+    cmd.AddValue("replications", "Maximum independent replications per cashier count", replications);
+    cmd.AddValue("batches", "Batch means per run for a single-run confidence interval (0 = off)", batches);
+    cmd.AddValue("minSamples", "Replications or batches required before the CI stopping rule applies", minSamples);
+    cmd.AddValue("ciHalfWidth", "Stop once the 95% CI half-width on average wait is below this (seconds, 0 = off)", ciHalfWidth);
+    cmd.AddValue("warmupTime", "Discard customers arriving before this time and reset utilization then (seconds)", warmupTime);
+    cmd.AddValue("autoWarmup", "Detect the warm-up period per cashier count with MSER-5 on a pilot run", autoWarmup);
+    cmd.AddValue("warmupPilotTime", "Length of the MSER-5 pilot run (seconds, 0 = simulationTime / 4)", warmupPilotTime);
+    cmd.AddValue("search", "Find the smallest cashier count meeting the target: none, bisection or analytic", search);
+    cmd.AddValue("targetWait", "Average wait the search must reach (seconds, 0 = utilization below 90%)", targetWait);
+    cmd.AddValue("crn", "Common random numbers: every cashier count sees the same arrivals and service demands", commonRandomNumbers);
+    cmd.AddValue("engine", "Event engine: ns3 (Simulator) or calendar (specialized indexed heap)", engine);
+    cmd.AddValue("rng", "Variate source: ns3 (MRG32k3a streams) or fast (xoshiro256** with a vectorized log)", randomSource);
+    cmd.AddValue("arrivalDistribution", "Interarrival times: exponential, erlang:K, lognormal:CV, deterministic or empirical:FILE", arrivalDistribution);
+    cmd.AddValue("serviceDistribution", "Service times: exponential, erlang:K, lognormal:CV, deterministic or empirical:FILE", serviceDistribution);
+    cmd.AddValue("arrivalSchedule", "CSV of 'start,rate' buckets for a time-varying arrival rate", arrivalSchedule);
+    cmd.AddValue("staffingPlan", "CSV of 'time,cashiers' steps; evaluates one run on maxCashiers lanes instead of a sweep", staffingPlan);
+    cmd.AddValue("openAbove", "Open an extra lane whenever more than this many customers queue (0 = off)", openAbove);
+    cmd.AddValue("topology", "Queues: pooled (one shared queue) or lanes (one per cashier)", topology);
+    cmd.AddValue("routing", "Lane chosen by an arrival with topology=lanes: jsq, random or power-of-two", routing);
+    cmd.AddValue("expressLanes", "Lanes reserved for small baskets with topology=lanes", expressLanes);
+    cmd.AddValue("expressItems", "Largest basket allowed in an express lane", expressItems);
+    cmd.AddValue("meanItems", "Average basket size; a basket's items scale with its service demand", meanItems);
+    cmd.AddValue("stores", "CSV of 'name,arrivalRate,serviceRate,maxCashiers[,schedule]' stores to size in one batch", storesFile);
+    cmd.AddValue("rank", "This process's share of the store batch (0-based)", rank);
+    cmd.AddValue("numRanks", "Number of processes the store batch is split across", numRanks);
+    cmd.AddValue("experiments", "TOML file of [[experiment]] grids to run in this process", experimentFile);
+    cmd.AddValue("columnarOutput", "Write results.bin and .bin traces and samples in the little-endian columnar format", columnarOutput);
+    cmd.AddValue("traceSampleEvery", "Trace only every Nth served customer", traceSampleEvery);
+    cmd.AddValue("traceCompression", "Compress customer traces: none, zstd or gzip (external command)", traceCompression);
+    cmd.AddValue("perCashierStats", "Print customers served and utilization for every cashier", perCashierStats);
+    cmd.AddValue("traceSweep", "Generate arrivals once and replay them for every cashier count without events (FCFS pooled)", traceSweep);
+    cmd.AddValue("replayTrace", "Drive arrivals and service demands from a recorded SMTRC001 trace file", replayTrace);
+    cmd.AddValue("recordTrace", "Write the arrivals a common-random-numbers run would see as an SMTRC001 trace file", recordTrace);
+    cmd.AddValue("checkpoint", "Save each run's state to <checkpoint>_<cashiers>.ckpt while it runs (calendar engine)", checkpoint);
+    cmd.AddValue("checkpointInterval", "Wall-clock seconds between checkpoints", checkpointInterval);
+    cmd.AddValue("resume", "Continue each run from its checkpoint file when one exists", resume);
+    cmd.AddValue("branchAt", "Run to this time once, then fork one continuation per branch plan (seconds, 0 = off)", branchAt);
+    cmd.AddValue("branchPlans", "Comma-separated staffing plans the branches switch to at branchAt", branchPlans);
+    cmd.AddValue("priorityShare", "Fraction of customers with a loyalty card, served before everyone else", priorityShare);
+    cmd.AddValue("balkAbove", "Arrivals leave at once when this many customers are waiting (0 = off)", balkAbove);
+    cmd.AddValue("meanPatience", "Mean patience of a waiting customer before abandoning the queue (seconds, 0 = off)", meanPatience);
+    cmd.AddValue("plotFormat", "Plots: script (write gnuplot scripts only), png or svg (also run gnuplot)", plotFormat);
+    cmd.AddValue("storeReports", "Write plot and data files prefixed with the name of every store or experiment run", storeReports);
+    cmd.AddValue("benchmark", "Measure the simulator instead of running the study; writes CSV", benchmark);
+    cmd.AddValue("benchmarkEngines", "Comma-separated engines to benchmark", benchmarkEngines);
+    cmd.AddValue("benchmarkCashiers", "Comma-separated cashier counts for the single-run cases", benchmarkCashiers);
+    cmd.AddValue("benchmarkLoads", "Comma-separated utilizations (rho) for the single-run cases", benchmarkLoads);
+    cmd.AddValue("benchmarkCustomers", "Expected arrivals per single-run case", benchmarkCustomers);
+    cmd.AddValue("benchmarkOutput", "CSV file the benchmark writes", benchmarkOutput);
     cmd.Parse(argc, argv);
    
+    if (CreateIdleCashierPool(cashierSelection) == nullptr)
+    {
+        std::cerr << "Error: Unknown cashier selection policy '" << cashierSelection << "'" << std::endl;
+        return 1;
+    }
+   
+    if (CreateEventEngine(engine) == nullptr)
+    {
+        std::cerr << "Error: Unknown event engine '" << engine << "'" << std::endl;
+        return 1;
+    }
+   
+    if (randomSource != "ns3" && randomSource != "fast")
+    {
+        std::cerr << "Error: Unknown random source '" << randomSource << "'" << std::endl;
+        return 1;
+    }
+   
+    std::shared_ptr<const DistributionSpec> arrivalSpec = ParseDistribution(arrivalDistribution);
+    std::shared_ptr<const DistributionSpec> serviceSpec = ParseDistribution(serviceDistribution);
+    if (arrivalSpec == nullptr || serviceSpec == nullptr)
+    {
+        return 1;
+    }
+    if (!IsExponential(arrivalSpec, serviceSpec) && (validateAnalytic || analyticPrune || search == "analytic"))
+    {
+        std::cerr << "Error: validateAnalytic, analyticPrune and search=analytic use Erlang-C, which needs "
+                  << "exponential distributions" << std::endl;
+        return 1;
+    }
+   
+    std::shared_ptr<ArrivalRateSchedule> schedule;
+    if (!arrivalSchedule.empty())
+    {
+        schedule = std::make_shared<ArrivalRateSchedule>();
+        if (!schedule->Load(arrivalSchedule))
+        {
+            return 1;
+        }
+    }
+   
+    std::shared_ptr<StaffingSchedule> plan;
+    if (!staffingPlan.empty())
+    {
+        plan = std::make_shared<StaffingSchedule>();
+        if (!plan->Load(staffingPlan))
+        {
+            return 1;
+        }
+    }
+    bool staffed = (plan || openAbove > 0);
+   
+    std::shared_ptr<MappedTrace> replay;
+    if (!replayTrace.empty())
+    {
+        replay = std::make_shared<MappedTrace>();
+        if (!replay->Open(replayTrace))
+        {
+            return 1;
+        }
+    }
+   
+    bool laneQueues;
+    LaneRouting laneRouting;
+    if (!ParseTopology(topology, routing, laneQueues, laneRouting))
+    {
+        std::cerr << "Error: Unknown topology '" << topology << "' or routing '" << routing << "'" << std::endl;
+        return 1;
+    }
+   
+    if (search != "none" && search != "bisection" && search != "analytic")
+    {
+        std::cerr << "Error: Unknown search mode '" << search << "'" << std::endl;
+        return 1;
+    }
+   
+    if (traceCompression != "none" && traceCompression != "zstd" && traceCompression != "gzip")
+    {
+        std::cerr << "Error: Unknown trace compression '" << traceCompression << "'" << std::endl;
+        return 1;
+    }
+   
+    if (plotFormat != "script" && plotFormat != "png" && plotFormat != "svg")
+    {
+        std::cerr << "Error: Unknown plot format '" << plotFormat << "'" << std::endl;
+        return 1;
+    }
+   
+    std::vector<BranchPlan> branches;
+    if (branchAt > 0)
+    {
+        std::vector<std::string> files;
+        if (!ParseExperimentValue("[" + branchPlans + "]", files) || files.empty())
+        {
+            std::cerr << "Error: branchAt needs at least one plan in branchPlans" << std::endl;
+            return 1;
+        }
+        for (auto& file : files)
+        {
+            auto branchPlan = std::make_shared<StaffingSchedule>();
+            if (!branchPlan->Load(file))
+            {
+                return 1;
+            }
+            if (branchPlan->GetMaxCashiers() > maxCashiers)
+            {
+                std::cerr << "Error: Branch plan " << file << " opens more than maxCashiers lanes" << std::endl;
+                return 1;
+            }
+            branches.push_back({file, branchPlan});
+        }
+        if (branchAt >= simulationTime || topology != "pooled" || !checkpoint.empty() || customerTrace ||
+            replications > 1 || autoWarmup || traceSweep)
+        {
+            std::cerr << "Error: branchAt must be before simulationTime and needs the pooled topology without "
+                      << "checkpoint, customerTrace, replications, autoWarmup or traceSweep" << std::endl;
+            return 1;
+        }
+    }
+   
+    if (numRanks == 0 || rank >= numRanks)
+    {
+        std::cerr << "Error: rank must be below numRanks" << std::endl;
+        return 1;
+    }
+   
+    if (workers == 0)
+    {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = (cores > 0) ? static_cast<uint32_t>(cores) : 1;
+    }
+   
     LogComponentEnable("SupermarketSimulation", LOG_LEVEL_INFO);
    
     allResults.clear();
-    waitingTimes.clear();
    
-    uint32_t expectedCustomers = static_cast<uint32_t>(arrivalRate * simulationTime);
+    SweepParameters params;
+    params.maxCashiers = maxCashiers;
+    params.arrivalRate = arrivalRate;
+    params.serviceRate = serviceRate;
+    params.simulationTime = simulationTime;
+    params.workers = workers;
+    params.keepRawSamples = keepRawSamples;
+    params.customerTrace = customerTrace;
+    params.cashierSelection = cashierSelection;
+    params.analyticPrune = analyticPrune;
+    params.pruneMargin = pruneMargin;
+    params.replications = std::max<uint32_t>(replications, 1);
+    params.batches = batches;
+    params.minSamples = minSamples;
+    params.ciHalfWidth = ciHalfWidth;
+    params.warmupTime = warmupTime;
+    params.autoWarmup = autoWarmup;
+    params.warmupPilotTime = warmupPilotTime;
+    params.search = search;
+    params.targetWait = targetWait;
+    params.commonRandomNumbers = commonRandomNumbers;
+    params.engine = engine;
+    params.randomSource = randomSource;
+    params.arrivalDistribution = arrivalDistribution;
+    params.serviceDistribution = serviceDistribution;
+    params.arrivalSpec = arrivalSpec;
+    params.serviceSpec = serviceSpec;
+    params.arrivalSchedule = schedule;
+    params.staffingPlan = plan;
+    params.openAbove = openAbove;
+    params.topology = topology;
+    params.routing = routing;
+    params.expressLanes = (topology == "lanes") ? expressLanes : 0;
+    params.expressItems = expressItems;
+    params.meanItems = meanItems;
+    params.columnarOutput = columnarOutput;
+    params.traceSampleEvery = traceSampleEvery;
+    params.traceCompression = traceCompression;
+    params.perCashierStats = perCashierStats;
+    params.traceSweep = traceSweep;
+    params.replayTrace = replay;
+    params.checkpoint = checkpoint;
+    params.priorityShare = priorityShare;
+    params.balkAbove = balkAbove;
+    params.meanPatience = meanPatience;
+    params.checkpointInterval = checkpointInterval;
+    params.resume = resume;
+    params.plotFormat = plotFormat;
+    params.storeReports = storeReports;
+    if (!ValidateParameters(params))
+    {
+        return 1;
+    }
+    // Checkpoint files are named by cashier count only, so grid points and
+    // stores of the same size would overwrite each other's.
+    if (replay && validateAnalytic)
+    {
+        std::cerr << "Error: validateAnalytic compares with M/M/c formulas, which a replayed trace need not follow"
+                  << std::endl;
+        return 1;
+    }
+    if (!checkpoint.empty() && (!storesFile.empty() || !experimentFile.empty() || benchmark))
+    {
+        std::cerr << "Error: checkpoint cannot be combined with stores, experiments or benchmark" << std::endl;
+        return 1;
+    }
+   
+    if (!storesFile.empty())
+    {
+        std::vector<StoreScenario> stores;
+        if (!LoadStoreScenarios(storesFile, params, stores))
+        {
+            return 1;
+        }
+        return RunStoreBatch(stores, workers, rank, numRanks);
+    }
+    if (!experimentFile.empty())
+    {
+        return RunExperimentFile(experimentFile, params, workers);
+    }
+    if (benchmark)
+    {
+        LogComponentDisable("SupermarketSimulation", LOG_LEVEL_ALL);
+        return RunBenchmarks(params, benchmarkEngines, benchmarkCashiers, benchmarkLoads, benchmarkCustomers,
+                             benchmarkOutput);
+    }
+   
+    if (!recordTrace.empty())
+    {
+        ArrivalTrace trace;
+        GenerateSweepTrace(params, trace);
+        if (!WriteReplayTrace(recordTrace, trace))
+        {
+            return 1;
+        }
+        std::cout << "Recorded " << trace.arrivals.size() << " arrivals to " << recordTrace << std::endl;
+    }
+   
+    uint32_t expectedCustomers = static_cast<uint32_t>(schedule ? schedule->ExpectedArrivals(simulationTime) :
+                                                                  arrivalRate * simulationTime);
    
     std::cout << "Supermarket M/M/c Queue Simulation" << std::endl;
     std::cout << "Arrival rate: " << arrivalRate << " customers/second" << std::endl;
     std::cout << "Service rate: " << serviceRate << " customers/second" << std::endl;
     std::cout << "Simulation time: " << simulationTime << " seconds" << std::endl;
     std::cout << "Expected customers: ~" << expectedCustomers << std::endl;
-    std::cout << "Testing 1 to " << maxCashiers << " cashiers" << std::endl;
+    if (replay)
+    {
+        std::cout << "Replaying " << replay->GetCount() << " recorded arrivals from " << replayTrace << std::endl;
+    }
+    if (staffed || branchAt > 0)
+    {
+        std::cout << "Dynamic staffing on up to " << maxCashiers << " lanes" << std::endl;
+    }
+    else
+    {
+        std::cout << "Testing 1 to " << maxCashiers << " cashiers" << std::endl;
+    }
    
-    for (uint32_t numCashiers = 1; numCashiers <= maxCashiers; numCashiers++)
+    if (branchAt > 0)
     {
-        SupermarketSimulation sim(numCashiers, arrivalRate, serviceRate);
-       
-        sim.RunSimulation(simulationTime);
-       
-        sim.PrintResults();
+        RunBranches(params, branches, branchAt);
+        return 0;
+    }
+   
+    // The writer takes results as the sweep records them, except when sweep
+    // workers are forked: no writer thread may be alive then, so it starts
+    // once they are done and the plots are written while the tables print.
+    bool forked = (workers > 1 && !staffed && search == "none");
+    std::string columnarFile = columnarOutput ? "results.bin" : "";
+    ReportWriter report;
+    if (!forked)
+    {
+        report.Start("", columnarFile, plotFormat);
+        g_reportWriter = &report;
+    }
+   
+    if (staffed)
+    {
+        RunCashierConfiguration(maxCashiers, params, std::cout);
+    }
+    else if (search != "none")
+    {
+        CashierSearch cashierSearch(params);
+        uint32_t found = cashierSearch.Run();
+        std::cout << "\nSearch (" << search << "): ";
+        if (found > 0)
+        {
+            std::cout << found << " cashiers is the smallest count meeting the target";
+        }
+        else
+        {
+            std::cout << "no count up to " << maxCashiers << " meets the target";
+        }
+        std::cout << " (" << cashierSearch.GetSimulations() << " simulations)" << std::endl;
+    }
+    else
+    {
+        std::vector<uint32_t> configurations = SelectSweepConfigurations(params);
+        if (analyticPrune)
+        {
+            std::cout << "Analytic pruning: simulating " << configurations.size() << " of "
+                      << maxCashiers << " cashier counts" << std::endl;
+        }
        
-        Simulator::Destroy();
+        if (traceSweep)
+        {
+            RunTraceSweep(params, configurations);
+        }
+        else if (workers > 1)
+        {
+            RunParallelSweep(params, configurations);
+        }
+        else
+        {
+            RunSerialSweep(params, configurations);
+        }
     }
    
+    g_reportWriter = nullptr;
+    if (forked)
+    {
+        report.Start("", columnarFile, plotFormat);
+        for (auto& result : allResults)
+        {
+            report.Submit(result);
+        }
+    }
+    report.Close();
+   
+    bool showCi = (params.replications > 1 || params.batches > 0);
+   
     std::cout << "\n Comparison Table " << std::endl;
-    std::cout << "Cashiers | Customers | Avg Wait Time | Utilization | Efficiency" << std::endl;
-    std::cout << "---------|-----------|---------------|-------------|------------" << std::endl;
+    std::cout << "Cashiers | Customers | Avg Wait Time | " << (showCi ? "  95% CI | " : "")
+              << "Utilization | Efficiency" << std::endl;
+    std::cout << "---------|-----------|---------------|-" << (showCi ? "---------|-" : "")
+              << "------------|------------" << std::endl;
    
     for (auto& result : allResults)
     {
         std::cout << std::setw(8) << result.numCashiers << " | "
                   << std::setw(9) << result.totalCustomers << " | "
-                  << std::setw(13) << std::fixed << std::setprecision(2) << result.avgWaitingTime << " | "
-                  << std::setw(11) << std::fixed << std::setprecision(1) << result.utilization * 100 << "% | "
+                  << std::setw(13) << std::fixed << std::setprecision(2) << result.avgWaitingTime << " | ";
+        if (showCi)
+        {
+            std::cout << "+-" << std::setw(6) << std::fixed << std::setprecision(2) << result.waitingTimeCiHalfWidth << " | ";
+        }
+        std::cout << std::setw(11) << std::fixed << std::setprecision(1) << result.utilization * 100 << "% | "
                   << std::setw(10) << std::fixed << std::setprecision(3) << result.efficiencyScore << std::endl;
     }
    
-    uint32_t optimalCashiers = FindOptimalCashiers();
+    uint32_t optimalCashiers = staffed ? 0 : FindOptimalCashiers();
    
     if (optimalCashiers > 0)
     {
@@ -692,8 +7506,22 @@ int main(int argc, char *argv[])
         }
     }
    
-    GenerateUtilizationPlot();
-    GenerateWaitingTimePlot();
+    if (validateAnalytic)
+    {
+        PrintAnalyticValidation(arrivalRate, serviceRate);
+    }
+   
+    bool reported = report.Wait();
+    std::cout << report.GetLog();
+    if (INSTRUMENTATION_ENABLED)
+    {
+        std::cout << "Plot generation: " << std::fixed << std::setprecision(3) << report.GetSeconds() * 1e3
+                  << " ms" << std::endl;
+    }
+    if (!reported)
+    {
+        return 1;
+    }
     std::cout << "\nPlot files generated successfully!" << std::endl;
    
     return 0;